@@ -18,10 +18,12 @@
 //
 
 #include "DBusBridge.h"
-
-#include <OrgUsbguardInterface.h>
+#include "DBusWorker.h"
 
 #include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
 #include <QDBusServiceWatcher>
 
 Q_DECLARE_METATYPE(DBusRule);
@@ -29,36 +31,61 @@ Q_DECLARE_METATYPE(DBusRules);
 Q_DECLARE_METATYPE(DBusAttributes);
 
 const QString DBusBridge::service = QLatin1String("org.usbguard1");
+const int DBusBridge::DefaultCoalescingInterval = 50;
+const int DBusBridge::InitialProbeInterval = 100;
+const int DBusBridge::MaxProbeInterval = 5000;
 
-DBusBridge::DBusBridge(QObject* parent) :
+DBusBridge::DBusBridge(const QDBusConnection& bus, QObject* parent) :
   QObject(parent),
+  _bus(bus),
   _reconnect_timer(this)
 {
   qDBusRegisterMetaType<DBusRule>();
   qDBusRegisterMetaType<DBusRules>();
   qDBusRegisterMetaType<DBusAttributes>();
+  qRegisterMetaType<DeviceEvents>("DeviceEvents");
+  qRegisterMetaType<Rule::Target>("Rule::Target");
 
   /*
-   * Wait 5 seconds before trying to connect when the D-Bus service appears;
-   * this is because usbguard-dbus has a 1 second timeout between the D-Bus
-   * registration and the IPC connection.
+   * usbguard-dbus registers its name before it is connected to the daemon,
+   * and answers with errors until then: when the service appears, probe it
+   * until it replies, waiting longer after each failure.
    */
-  _reconnect_timer.setInterval(5000);
   _reconnect_timer.setSingleShot(true);
-  QObject::connect(&_reconnect_timer, &QTimer::timeout, this, &DBusBridge::createInterfaces);
+  QObject::connect(&_reconnect_timer, &QTimer::timeout, this, &DBusBridge::probeService);
+
+  /*
+   * The device signals are received, decoded and coalesced by the worker,
+   * in its own thread; only the batches of events reach this thread.
+   */
+  _worker = new DBusWorker(_bus);
+  _worker->moveToThread(&_worker_thread);
+  QObject::connect(&_worker_thread, &QThread::finished,
+    _worker, &QObject::deleteLater);
+  QObject::connect(_worker, &DBusWorker::interfaceCreated,
+    this, &DBusBridge::workerInterfaceCreated);
+  QObject::connect(_worker, &DBusWorker::devicesChanged,
+    this, &DBusBridge::workerDevicesChanged);
+  _worker_thread.setObjectName(QLatin1String("DBusWorker"));
+  _worker_thread.start();
 }
 
 DBusBridge::~DBusBridge()
 {
+  _worker_thread.quit();
+  _worker_thread.wait();
 }
 
-QDBusReply<bool> DBusBridge::tryConnect()
+void DBusBridge::tryConnect()
 {
-  QDBusConnection bus = QDBusConnection::systemBus();
+  if (!_bus.isConnected()) {
+    Q_EMIT connectionFailed(_bus.lastError().message());
+    return;
+  }
 
   if (!_watcher) {
     _watcher = new QDBusServiceWatcher(this);
-    _watcher->setConnection(bus);
+    _watcher->setConnection(_bus);
     _watcher->setWatchMode(QDBusServiceWatcher::WatchForRegistration | QDBusServiceWatcher::WatchForUnregistration);
     _watcher->addWatchedService(service);
     QObject::connect(_watcher, &QDBusServiceWatcher::serviceRegistered,
@@ -67,72 +94,169 @@ QDBusReply<bool> DBusBridge::tryConnect()
       this, &DBusBridge::destroyInterfaces);
   }
 
-  QDBusReply<bool> reply = bus.interface()->isServiceRegistered(service);
-  if (reply.isValid() && reply.value()) {
-    createInterfaces();
-  }
-  return reply;
+  QDBusPendingCall call = _bus.interface()->asyncCall(QLatin1String("NameHasOwner"), service);
+  auto watcher = new QDBusPendingCallWatcher(call, this);
+  QObject::connect(watcher, &QDBusPendingCallWatcher::finished,
+    this, &DBusBridge::dbusServiceRegistrationChecked);
 }
 
 bool DBusBridge::isConnected() const
 {
-  return _devices_interface;
+  return _connected;
 }
 
+QDBusMessage DBusBridge::createDevicesMethodCall(const QString& method) const
+{
+  return QDBusMessage::createMethodCall(service, QLatin1String("/org/usbguard1/Devices"),
+    QLatin1String("org.usbguard.Devices1"), method);
+}
+
+/*
+ * The method calls do not go through the interface owned by the worker:
+ * the connection is thread-safe, and the replies are then delivered in
+ * the thread of the caller.
+ */
 QDBusPendingReply<DBusRules> DBusBridge::listDevices(const QString& query)
 {
-  QDBusPendingReply<DBusRules> reply = _devices_interface->listDevices(query);
-  reply.waitForFinished();
-  return reply;
+  QDBusMessage message = createDevicesMethodCall(QLatin1String("listDevices"));
+  message << query;
+  return _bus.asyncCall(message);
 }
 
 QDBusPendingReply<uint> DBusBridge::applyDevicePolicy(uint id, Rule::Target target, bool permanent)
 {
-  QDBusPendingReply<uint> reply = _devices_interface->applyDevicePolicy(id, static_cast<uint>(target), permanent);
-  reply.waitForFinished();
-  return reply;
+  QDBusMessage message = createDevicesMethodCall(QLatin1String("applyDevicePolicy"));
+  message << id << static_cast<uint>(target) << permanent;
+  return _bus.asyncCall(message);
+}
+
+QDBusConnection DBusBridge::connectionFromString(const QString& bus)
+{
+  if (bus.isEmpty() || bus == QLatin1String("system")) {
+    return QDBusConnection::systemBus();
+  }
+
+  if (bus == QLatin1String("session")) {
+    return QDBusConnection::sessionBus();
+  }
+
+  /*
+   * Any other value is the address of a bus, e.g. a private one running
+   * a stand-in org.usbguard1 service.
+   */
+  return QDBusConnection::connectToBus(bus, QLatin1String("usbguard-applet-qt"));
+}
+
+int DBusBridge::coalescingInterval() const
+{
+  return _coalescing_interval;
+}
+
+void DBusBridge::setCoalescingInterval(int msec)
+{
+  _coalescing_interval = msec;
+  QMetaObject::invokeMethod(_worker, [worker = _worker, msec]() {
+      worker->setCoalescingInterval(msec);
+    }, Qt::QueuedConnection);
 }
 
 void DBusBridge::createInterfaces()
 {
-  QDBusConnection bus = QDBusConnection::systemBus();
+  _connecting = true;
+  const int generation = _probe_generation;
+  QMetaObject::invokeMethod(_worker, [worker = _worker, generation]() {
+      worker->createInterface(generation);
+    }, Qt::QueuedConnection);
+}
 
-  _devices_interface = new OrgUsbguardDevices1Interface(service, QLatin1String("/org/usbguard1/Devices"), bus, this);
-  QObject::connect(_devices_interface, &OrgUsbguardDevices1Interface::DevicePolicyApplied,
-    this, &DBusBridge::dbusDevicePolicyApplied);
-  QObject::connect(_devices_interface, &OrgUsbguardDevices1Interface::DevicePolicyChanged,
-    this, &DBusBridge::dbusDevicePolicyChanged);
-  QObject::connect(_devices_interface, &OrgUsbguardDevices1Interface::DevicePresenceChanged,
-    this, &DBusBridge::dbusDevicePresenceChanged);
+void DBusBridge::workerInterfaceCreated(int generation)
+{
+  /* The service went away while the worker was subscribing. */
+  if (!_connecting || generation != _probe_generation) {
+    return;
+  }
 
+  _connecting = false;
+  _connected = true;
   Q_EMIT serviceAvailable();
 }
 
+void DBusBridge::workerDevicesChanged(const DeviceEvents& events)
+{
+  /* A batch sent by the worker before it was told that the service left. */
+  if (!_connected) {
+    return;
+  }
+
+  Q_EMIT devicesChanged(events);
+}
+
 void DBusBridge::destroyInterfaces()
 {
   _reconnect_timer.stop();
+  ++_probe_generation;
+  _connecting = false;
+  _connected = false;
+  QMetaObject::invokeMethod(_worker, &DBusWorker::destroyInterface, Qt::QueuedConnection);
   Q_EMIT serviceUnavailable();
-
-  delete _devices_interface;
-  _devices_interface = nullptr;
 }
 
 void DBusBridge::dbusServiceRegistered()
 {
-  _reconnect_timer.start();
+  /* Abandon any probe still running, e.g. from tryConnect. */
+  _reconnect_timer.stop();
+  ++_probe_generation;
+  _probe_interval = InitialProbeInterval;
+  probeService();
 }
 
-void DBusBridge::dbusDevicePolicyApplied(uint id, uint target_new, const QString& device_rule, uint rule_id, DBusAttributes attributes)
+void DBusBridge::probeService()
 {
-  Q_EMIT devicePolicyApplied(id, static_cast<Rule::Target>(target_new), device_rule, rule_id);
-}
+  if (_connected || _connecting) {
+    return;
+  }
 
-void DBusBridge::dbusDevicePolicyChanged(uint id, uint target_old, uint target_new, const QString& device_rule, uint rule_id, DBusAttributes attributes)
-{
-  Q_EMIT devicePolicyChanged(id, static_cast<Rule::Target>(target_old), static_cast<Rule::Target>(target_new), device_rule, rule_id);
+  QDBusMessage message = QDBusMessage::createMethodCall(service, QLatin1String("/org/usbguard1"),
+    QLatin1String("org.usbguard1"), QLatin1String("getParameter"));
+  message << QLatin1String("ImplicitPolicyTarget");
+  auto watcher = new QDBusPendingCallWatcher(_bus.asyncCall(message), this);
+  const int generation = _probe_generation;
+  QObject::connect(watcher, &QDBusPendingCallWatcher::finished,
+    this, [this, generation](QDBusPendingCallWatcher* watcher) {
+      QDBusPendingReply<QString> reply = *watcher;
+      watcher->deleteLater();
+
+      /* The service went away while the probe was in flight. */
+      if (generation != _probe_generation || _connected || _connecting) {
+        return;
+      }
+
+      /*
+       * A denied parameter read still means that the daemon answered; the
+       * device calls have their own authorization.
+       */
+      if (reply.isValid() || reply.error().type() == QDBusError::AccessDenied) {
+        createInterfaces();
+        return;
+      }
+
+      _reconnect_timer.start(_probe_interval);
+      _probe_interval = qMin(_probe_interval * 2, MaxProbeInterval);
+    });
 }
 
-void DBusBridge::dbusDevicePresenceChanged(uint id, uint event, uint target, const QString& device_rule, DBusAttributes attributes)
+void DBusBridge::dbusServiceRegistrationChecked(QDBusPendingCallWatcher* watcher)
 {
-  Q_EMIT devicePresenceChanged(id, static_cast<DeviceManager::EventType>(event), static_cast<Rule::Target>(target), device_rule);
+  QDBusPendingReply<bool> reply = *watcher;
+  watcher->deleteLater();
+
+  if (!reply.isValid()) {
+    Q_EMIT connectionFailed(reply.error().message());
+  }
+  else if (!reply.value()) {
+    Q_EMIT connectionFailed(QLatin1String("D-Bus service not available"));
+  }
+  else if (!_connected && !_connecting) {
+    dbusServiceRegistered();
+  }
 }
@@ -21,47 +21,98 @@
 #include "DBusTypes.h"
 #include "LibUsbguard.h"
 
+#include <QDBusConnection>
+#include <QDBusMessage>
 #include <QDBusPendingReply>
-#include <QDBusReply>
+#include <QList>
 #include <QObject>
+#include <QThread>
 #include <QTimer>
 
+class QDBusPendingCallWatcher;
 class QDBusServiceWatcher;
-class OrgUsbguardDevices1Interface;
+class DBusWorker;
+
+struct DevicePresenceEvent
+{
+  uint id;
+  DeviceManager::EventType event;
+  Rule::Target target;
+  LazyRule device_rule;
+};
+
+struct DevicePolicyEvent
+{
+  uint id;
+  Rule::Target target_old;
+  Rule::Target target_new;
+  LazyRule device_rule;
+  uint rule_id;
+};
+
+/*
+ * The device events received within one coalescing interval, at most one
+ * presence and one policy event per device, in the order the devices were
+ * first seen.
+ */
+struct DeviceEvents
+{
+  QList<DevicePresenceEvent> presence;
+  QList<DevicePolicyEvent> policy;
+};
+
+Q_DECLARE_METATYPE(DeviceEvents);
 
 class DBusBridge : public QObject
 {
   Q_OBJECT
 
 public:
-  explicit DBusBridge(QObject* parent = nullptr);
+  explicit DBusBridge(const QDBusConnection& bus = QDBusConnection::systemBus(), QObject* parent = nullptr);
   ~DBusBridge();
 
-  QDBusReply<bool> tryConnect();
+  void tryConnect();
   bool isConnected() const;
 
   QDBusPendingReply<DBusRules> listDevices(const QString& query);
   QDBusPendingReply<uint> applyDevicePolicy(uint id, Rule::Target target, bool permanent);
 
+  static QDBusConnection connectionFromString(const QString& bus);
+
+  int coalescingInterval() const;
+  void setCoalescingInterval(int msec);
+
+  static const int DefaultCoalescingInterval;
+  static const int InitialProbeInterval;
+  static const int MaxProbeInterval;
+  static const QString service;
+
 Q_SIGNALS:
+  void connectionFailed(const QString& message);
   void serviceAvailable();
   void serviceUnavailable();
-  void devicePolicyApplied(uint id, Rule::Target target_new, const QString& device_rule, uint rule_id);
-  void devicePolicyChanged(uint id, Rule::Target target_old, Rule::Target target_new, const QString& device_rule, uint rule_id);
-  void devicePresenceChanged(uint id, DeviceManager::EventType event, Rule::Target target, const QString& device_rule);
+  void devicesChanged(const DeviceEvents& events);
 
 private Q_SLOTS:
   void createInterfaces();
   void destroyInterfaces();
   void dbusServiceRegistered();
-  void dbusDevicePolicyApplied(uint id, uint target_new, const QString& device_rule, uint rule_id, DBusAttributes attributes);
-  void dbusDevicePolicyChanged(uint id, uint target_old, uint target_new, const QString& device_rule, uint rule_id, DBusAttributes attributes);
-  void dbusDevicePresenceChanged(uint id, uint event, uint target, const QString& device_rule, DBusAttributes attributes);
+  void probeService();
+  void dbusServiceRegistrationChecked(QDBusPendingCallWatcher* watcher);
+  void workerInterfaceCreated(int generation);
+  void workerDevicesChanged(const DeviceEvents& events);
 
 private:
+  QDBusMessage createDevicesMethodCall(const QString& method) const;
+
+  QDBusConnection _bus;
   QTimer _reconnect_timer;
+  int _probe_generation = 0;
+  int _probe_interval = InitialProbeInterval;
+  int _coalescing_interval = DefaultCoalescingInterval;
+  bool _connecting = false;
+  bool _connected = false;
   QDBusServiceWatcher* _watcher = nullptr;
-  OrgUsbguardDevices1Interface* _devices_interface = nullptr;
-
-  static const QString service;
+  QThread _worker_thread;
+  DBusWorker* _worker = nullptr;
 };
@@ -0,0 +1,175 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+
+#include "DBusWorker.h"
+#include "Diagnostics.h"
+
+#include <OrgUsbguardInterface.h>
+
+DBusWorker::DBusWorker(const QDBusConnection& bus) :
+  QObject(nullptr),
+  _bus(bus),
+  _coalescing_timer(this)
+{
+  /*
+   * Plugging a hub produces a burst of events for it and its children;
+   * collect them and deliver them together once the interval is over.
+   */
+  _coalescing_timer.setInterval(DBusBridge::DefaultCoalescingInterval);
+  _coalescing_timer.setSingleShot(true);
+  QObject::connect(&_coalescing_timer, &QTimer::timeout, this, &DBusWorker::deliverDeviceEvents);
+}
+
+DBusWorker::~DBusWorker()
+{
+}
+
+void DBusWorker::createInterface(int generation)
+{
+  if (_devices_interface) {
+    Q_EMIT interfaceCreated(generation);
+    return;
+  }
+
+  _devices_interface = new OrgUsbguardDevices1Interface(DBusBridge::service,
+    QLatin1String("/org/usbguard1/Devices"), _bus, this);
+  QObject::connect(_devices_interface, &OrgUsbguardDevices1Interface::DevicePolicyChanged,
+    this, &DBusWorker::dbusDevicePolicyChanged);
+  QObject::connect(_devices_interface, &OrgUsbguardDevices1Interface::DevicePresenceChanged,
+    this, &DBusWorker::dbusDevicePresenceChanged);
+
+  Q_EMIT interfaceCreated(generation);
+}
+
+void DBusWorker::destroyInterface()
+{
+  clearDeviceEvents();
+  delete _devices_interface;
+  _devices_interface = nullptr;
+}
+
+void DBusWorker::setCoalescingInterval(int msec)
+{
+  _coalescing_timer.setInterval(msec);
+}
+
+void DBusWorker::dbusDevicePolicyChanged(uint id, uint target_old, uint target_new, const QString& device_rule, uint rule_id, DBusAttributes attributes)
+{
+  Diagnostics::Timer timer(Diagnostics::Stage::SignalReceive);
+  LazyRule device_record(device_rule, static_cast<Rule::Target>(target_new), attributes);
+  device_record.setRuleID(id);
+  auto it = _policy_events.find(id);
+
+  if (it == _policy_events.end()) {
+    _policy_order.append(id);
+    _policy_events.insert(id, DevicePolicyEvent{ id, static_cast<Rule::Target>(target_old),
+      static_cast<Rule::Target>(target_new), device_record, rule_id });
+  }
+  else {
+    /* Keep the target the device had before the burst. */
+    it->target_new = static_cast<Rule::Target>(target_new);
+    it->device_rule = device_record;
+    it->rule_id = rule_id;
+  }
+
+  if (!_coalescing_timer.isActive()) {
+    _coalescing_timer.start();
+  }
+}
+
+void DBusWorker::dbusDevicePresenceChanged(uint id, uint event, uint target, const QString& device_rule, DBusAttributes attributes)
+{
+  Diagnostics::Timer timer(Diagnostics::Stage::SignalReceive);
+  const auto event_type = static_cast<DeviceManager::EventType>(event);
+  LazyRule device_record(device_rule, static_cast<Rule::Target>(target), attributes);
+  device_record.setRuleID(id);
+  auto it = _presence_events.find(id);
+
+  if (it == _presence_events.end()) {
+    _presence_order.append(id);
+    _presence_events.insert(id, DevicePresenceEvent{ id, event_type,
+      static_cast<Rule::Target>(target), device_record });
+  }
+  else if (event_type == DeviceManager::EventType::Update &&
+    (it->event == DeviceManager::EventType::Insert || it->event == DeviceManager::EventType::Present)) {
+    /* An update of a device just seen is still an insertion. */
+    it->target = static_cast<Rule::Target>(target);
+    it->device_rule = device_record;
+  }
+  else {
+    *it = DevicePresenceEvent{ id, event_type, static_cast<Rule::Target>(target), device_record };
+  }
+
+  /* The device is gone, so a policy change is not interesting anymore. */
+  if (event_type == DeviceManager::EventType::Remove) {
+    _policy_events.remove(id);
+  }
+
+  if (!_coalescing_timer.isActive()) {
+    _coalescing_timer.start();
+  }
+}
+
+void DBusWorker::deliverDeviceEvents()
+{
+  /*
+   * The records are scanned here, and the ones that will get a decision
+   * dialog fully parsed: the GUI thread only reads the cached values.
+   */
+  DeviceEvents events;
+
+  for (const uint id : std::as_const(_presence_order)) {
+    auto it = _presence_events.find(id);
+
+    if (it != _presence_events.end()) {
+      it->device_rule.getHash();
+      events.presence.append(*it);
+      _presence_events.erase(it);
+    }
+  }
+
+  for (const uint id : std::as_const(_policy_order)) {
+    auto it = _policy_events.find(id);
+
+    if (it != _policy_events.end()) {
+      it->device_rule.getHash();
+
+      if (it->target_new == Rule::Target::Block && it->rule_id == Rule::ImplicitID) {
+        it->device_rule.rule();
+      }
+
+      events.policy.append(*it);
+      _policy_events.erase(it);
+    }
+  }
+
+  clearDeviceEvents();
+  Q_EMIT devicesChanged(events);
+}
+
+void DBusWorker::clearDeviceEvents()
+{
+  _coalescing_timer.stop();
+  _presence_order.clear();
+  _presence_events.clear();
+  _policy_order.clear();
+  _policy_events.clear();
+}
+
+/* vim: set ts=2 sw=2 et */
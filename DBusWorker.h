@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+#pragma once
+
+#include "DBusBridge.h"
+#include "DBusTypes.h"
+
+#include <QDBusConnection>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QTimer>
+
+class OrgUsbguardDevices1Interface;
+
+/*
+ * The part of DBusBridge living in its own thread: it owns the Devices1
+ * interface, so the device signals are demarshalled there, turns them into
+ * device records, and coalesces them. Only the finished batches reach the
+ * GUI thread, through a queued connection.
+ *
+ * All the methods are called through queued invocations from DBusBridge.
+ */
+class DBusWorker : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit DBusWorker(const QDBusConnection& bus);
+  ~DBusWorker();
+
+public Q_SLOTS:
+  void createInterface(int generation);
+  void destroyInterface();
+  void setCoalescingInterval(int msec);
+
+Q_SIGNALS:
+  void interfaceCreated(int generation);
+  void devicesChanged(const DeviceEvents& events);
+
+private Q_SLOTS:
+  void dbusDevicePolicyChanged(uint id, uint target_old, uint target_new, const QString& device_rule, uint rule_id, DBusAttributes attributes);
+  void dbusDevicePresenceChanged(uint id, uint event, uint target, const QString& device_rule, DBusAttributes attributes);
+  void deliverDeviceEvents();
+
+private:
+  void clearDeviceEvents();
+
+  QDBusConnection _bus;
+  QTimer _coalescing_timer;
+  QList<uint> _presence_order;
+  QHash<uint, DevicePresenceEvent> _presence_events;
+  QList<uint> _policy_order;
+  QHash<uint, DevicePolicyEvent> _policy_events;
+  OrgUsbguardDevices1Interface* _devices_interface = nullptr;
+};
+
+/* vim: set ts=2 sw=2 et */
@@ -57,17 +57,21 @@ void DeviceDialog::setDeviceID(const QString& vendor_id, const QString& product_
 void DeviceDialog::setSerial(const QString& serial)
 {
   qCDebug(LOG) << "Masking serial number value";
-  _serial = serial;
+  _serial = _mask_serial_number ? maskSerialNumber(serial) : serial;
+  ui->serial_label->setText(_serial);
+}
 
-  if (_mask_serial_number) {
-    for (int i = _serial.size(), p = 1; i > 0; --i, ++p) {
-      if ((p % 2) == 0) {
-        _serial[i - 1] = QLatin1Char('*');
-      }
+QString DeviceDialog::maskSerialNumber(const QString& serial)
+{
+  QString masked = serial;
+
+  for (int i = masked.size(), p = 1; i > 0; --i, ++p) {
+    if ((p % 2) == 0) {
+      masked[i - 1] = QLatin1Char('*');
     }
   }
 
-  ui->serial_label->setText(_serial);
+  return masked;
 }
 
 void DeviceDialog::setInterfaceTypes(const std::vector<usbguard::USBInterfaceType>& interfaces)
@@ -56,6 +56,8 @@ public:
   void setRandomizePosition(bool randomize);
   void setMaskSerialNumber(bool state);
 
+  static QString maskSerialNumber(const QString& serial);
+
 Q_SIGNALS:
   void allowed(quint32 id, bool permanent);
   void blocked(quint32 id, bool permanent);
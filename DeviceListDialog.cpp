@@ -0,0 +1,248 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+
+#include "DeviceListDialog.h"
+#include "DeviceDialog.h"
+#include "Log.h"
+#include <ui_DeviceListDialog.h>
+
+#include <QComboBox>
+#include <QCoreApplication>
+#include <QGuiApplication>
+#include <QRandomGenerator>
+#include <QScreen>
+#include <QStyle>
+#include <QTreeWidget>
+
+#include <utility>
+
+DeviceListDialog::DeviceListDialog(QWidget* parent) :
+  QDialog(parent),
+  ui(new Ui::DeviceListDialog),
+  _reject_enabled(false),
+  _mask_serial_number(false)
+{
+  qCDebug(LOG) << "Creating DeviceListDialog";
+  ui->setupUi(this);
+  setWindowTitle(tr("USB Devices Inserted"));
+  setWindowIcon(QIcon(QLatin1String(":/usbguard-icon.svg")));
+  setWindowFlags(Qt::CustomizeWindowHint|Qt::WindowStaysOnTopHint);
+  setAttribute(Qt::WA_DeleteOnClose);
+  connect(&timer, &QTimer::timeout, this, &DeviceListDialog::timerUpdate);
+  setDefaultDecisionTimeout(23);
+  setRejectVisible(false);
+  setRandomizePosition(false);
+  setDefaultDecision(Rule::Target::Block);
+  updateDialog();
+  timer.start(1000);
+}
+
+DeviceListDialog::~DeviceListDialog()
+{
+  delete ui;
+}
+
+void DeviceListDialog::setDefaultDecision(Rule::Target target)
+{
+  switch (target) {
+  case Rule::Target::Allow:
+  case Rule::Target::Block:
+    _default_decision = target;
+    break;
+
+  case Rule::Target::Reject:
+  case Rule::Target::Unknown:
+  case Rule::Target::Empty:
+  case Rule::Target::Invalid:
+  case Rule::Target::Match:
+  case Rule::Target::Device:
+  default:
+    _default_decision = _reject_enabled ? Rule::Target::Reject : Rule::Target::Block;
+  }
+
+  ui->apply_button->setFocus();
+}
+
+void DeviceListDialog::setDefaultDecisionTimeout(quint32 seconds)
+{
+  time_left = seconds;
+}
+
+void DeviceListDialog::setDecisionIsPermanent(bool state)
+{
+  ui->permanent_checkbox->setChecked(state);
+}
+
+void DeviceListDialog::setRejectVisible(bool state)
+{
+  _reject_enabled = state;
+  ui->reject_all_button->setHidden(!state);
+}
+
+void DeviceListDialog::setRandomizePosition(bool randomize)
+{
+  QRect position_rect = \
+    QStyle::alignedRect(Qt::LeftToRight, Qt::AlignCenter,
+      size(), qGuiApp->primaryScreen()->availableGeometry());
+
+  if (randomize) {
+    const int h = ui->block_all_button->height();
+    const int w = ui->block_all_button->width();
+    const int dy = QRandomGenerator::global()->bounded(-2 * h, 2 * h + 1);
+    const int dx = QRandomGenerator::global()->bounded(-2 * w, 2 * w + 1);
+    position_rect.translate(dx, dy);
+  }
+
+  setGeometry(position_rect);
+}
+
+void DeviceListDialog::setMaskSerialNumber(bool state)
+{
+  _mask_serial_number = state;
+}
+
+void DeviceListDialog::addDevice(quint32 id, const LazyRule& device_rule, const QString& parent_name)
+{
+  qCDebug(LOG) << "id=" << id;
+  const QString parent_hash = device_rule.getParentHash();
+  QTreeWidgetItem* parent_item = _parent_items.value(parent_hash, nullptr);
+
+  if (!parent_item) {
+    parent_item = new QTreeWidgetItem(ui->device_tree);
+    parent_item->setText(0, parent_name.isEmpty() ? tr("Other devices") : parent_name);
+    parent_item->setFirstColumnSpanned(true);
+    _parent_items.insert(parent_hash, parent_item);
+  }
+
+  const QString serial = device_rule.getSerial();
+  auto item = new QTreeWidgetItem(parent_item);
+  item->setText(1, device_rule.getDeviceID());
+  item->setText(2, device_rule.getName());
+  item->setText(3, _mask_serial_number ? DeviceDialog::maskSerialNumber(serial) : serial);
+  item->setText(4, device_rule.getViaPort());
+
+  auto combobox = new QComboBox();
+  combobox->addItem(QCoreApplication::translate("DeviceModel", "Allow"), QVariant::fromValue(Rule::Target::Allow));
+  combobox->addItem(QCoreApplication::translate("DeviceModel", "Block"), QVariant::fromValue(Rule::Target::Block));
+
+  if (_reject_enabled) {
+    combobox->addItem(QCoreApplication::translate("DeviceModel", "Reject"), QVariant::fromValue(Rule::Target::Reject));
+  }
+
+  combobox->setCurrentIndex(combobox->findData(QVariant::fromValue(_default_decision)));
+  ui->device_tree->setItemWidget(item, 0, combobox);
+  _decisions.insert(id, combobox);
+}
+
+void DeviceListDialog::layoutDevices()
+{
+  ui->device_tree->expandAll();
+
+  for (int column = 0; column < ui->device_tree->columnCount(); ++column) {
+    ui->device_tree->resizeColumnToContents(column);
+  }
+}
+
+void DeviceListDialog::timerUpdate()
+{
+  if (time_left > 0) {
+    --time_left;
+    updateDialog();
+  }
+  else {
+    timer.stop();
+    on_apply_button_clicked();
+  }
+}
+
+void DeviceListDialog::reject()
+{
+  if (timer.isActive()) {
+    timer.stop();
+    updateDialog();
+  }
+  else {
+    QDialog::reject();
+  }
+}
+
+void DeviceListDialog::accept()
+{
+  if (timer.isActive()) {
+    timer.stop();
+  }
+
+  QDialog::accept();
+}
+
+void DeviceListDialog::updateDialog()
+{
+  const QString label = tr("Apply");
+
+  if (timer.isActive()) {
+    ui->apply_button->setText(QString::fromLatin1("%1 [%2]").arg(label).arg(time_left));
+  }
+  else {
+    ui->apply_button->setText(label);
+    ui->hint_label->setText(tr("(Press Escape to close this window)"));
+  }
+}
+
+void DeviceListDialog::decideAll(Rule::Target target)
+{
+  for (QComboBox* combobox : std::as_const(_decisions)) {
+    const int index = combobox->findData(QVariant::fromValue(target));
+
+    if (index != -1) {
+      combobox->setCurrentIndex(index);
+    }
+  }
+
+  on_apply_button_clicked();
+}
+
+void DeviceListDialog::on_allow_all_button_clicked()
+{
+  decideAll(Rule::Target::Allow);
+}
+
+void DeviceListDialog::on_block_all_button_clicked()
+{
+  decideAll(Rule::Target::Block);
+}
+
+void DeviceListDialog::on_reject_all_button_clicked()
+{
+  decideAll(Rule::Target::Reject);
+}
+
+void DeviceListDialog::on_apply_button_clicked()
+{
+  QMap<quint32, Rule::Target> targets;
+
+  for (auto it = _decisions.constBegin(); it != _decisions.constEnd(); ++it) {
+    targets.insert(it.key(), it.value()->currentData().value<Rule::Target>());
+  }
+
+  qCDebug(LOG) << "Applying decisions for" << targets.count() << "devices";
+  Q_EMIT decided(targets, ui->permanent_checkbox->isChecked());
+  accept();
+}
+
+/* vim: set ts=2 sw=2 et */
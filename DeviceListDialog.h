@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+#pragma once
+
+#include "LibUsbguard.h"
+
+#include <QDialog>
+#include <QHash>
+#include <QMap>
+#include <QTimer>
+
+class QComboBox;
+class QTreeWidgetItem;
+
+namespace Ui
+{
+  class DeviceListDialog;
+}
+
+/*
+ * Asks for a decision about several devices at once, e.g. a hub and the
+ * devices connected to it; the devices are grouped by their parent.
+ */
+class DeviceListDialog : public QDialog
+{
+  Q_OBJECT
+
+public:
+  explicit DeviceListDialog(QWidget* parent = nullptr);
+  ~DeviceListDialog();
+
+  // The settings have to be set before adding the devices.
+  void setDefaultDecision(Rule::Target target);
+  void setDefaultDecisionTimeout(quint32 seconds);
+  void setDecisionIsPermanent(bool state);
+  void setRejectVisible(bool state);
+  void setRandomizePosition(bool randomize);
+  void setMaskSerialNumber(bool state);
+
+  void addDevice(quint32 id, const LazyRule& device_rule, const QString& parent_name);
+  // Expands and sizes the tree; call once, after adding all the devices.
+  void layoutDevices();
+
+Q_SIGNALS:
+  void decided(const QMap<quint32, Rule::Target>& targets, bool permanent);
+
+protected Q_SLOTS:
+  void timerUpdate();
+
+protected:
+  void reject();
+  void accept();
+  void updateDialog();
+  void decideAll(Rule::Target target);
+
+private Q_SLOTS:
+  void on_allow_all_button_clicked();
+  void on_block_all_button_clicked();
+  void on_reject_all_button_clicked();
+  void on_apply_button_clicked();
+
+private:
+  Ui::DeviceListDialog* ui;
+  Rule::Target _default_decision;
+  bool _reject_enabled;
+  bool _mask_serial_number;
+
+  QTimer timer;
+  int time_left;
+
+  QHash<QString, QTreeWidgetItem*> _parent_items;
+  QMap<quint32, QComboBox*> _decisions;
+};
+
+/* vim: set ts=2 sw=2 et */
@@ -18,10 +18,13 @@
 //
 
 #include "DeviceModel.h"
+#include "Diagnostics.h"
 #include "Log.h"
 
 #include <iostream>
+#include <QByteArray>
 #include <QList>
+#include <QSet>
 #include <QVector>
 #include <QCoreApplication>
 
@@ -29,7 +32,7 @@ class DeviceModelItem
 {
 public:
   DeviceModelItem();
-  explicit DeviceModelItem(const Rule& device_rule, DeviceModelItem* parent);
+  explicit DeviceModelItem(const LazyRule& device_rule, DeviceModelItem* parent);
   ~DeviceModelItem();
 
   void appendChild(DeviceModelItem* child);
@@ -42,8 +45,9 @@ public:
   int row() const;
   DeviceModelItem* parent();
 
-  QString getDeviceHash() const;
+  QByteArray getDeviceHashKey() const;
   quint32 getDeviceID() const;
+  QString getDeviceName() const;
 
   Rule::Target getRequestedTarget() const;
   Rule::Target getDeviceTarget() const;
@@ -54,20 +58,44 @@ public:
 private:
   QList<DeviceModelItem*> _children;
   DeviceModelItem* _parent = nullptr;
-  Rule _device_rule;
+  int _row = 0;
+  quint32 _device_id = 0;
+  QByteArray _device_hash_key;
+  Rule::Target _device_target;
   Rule::Target _requested_target;
+
+  /*
+   * The display strings are computed once, as data() is called for every
+   * cell on each repaint; the translated target is looked up by the model.
+   */
+  QString _usb_id;
+  QString _name;
+  QString _serial;
+  QString _port;
+  QString _interfaces;
 };
 
 DeviceModelItem::DeviceModelItem() :
+  _device_target(Rule::Target::Invalid),
   _requested_target(Rule::Target::Invalid)
 {
 }
 
-DeviceModelItem::DeviceModelItem(const Rule& device_rule, DeviceModelItem* parent) :
+DeviceModelItem::DeviceModelItem(const LazyRule& device_rule, DeviceModelItem* parent) :
   _parent(parent),
-  _device_rule(device_rule),
-  _requested_target(device_rule.getTarget())
+  _device_id(device_rule.getRuleID()),
+  _device_hash_key(device_rule.getHashKey()),
+  _device_target(device_rule.getTarget()),
+  _requested_target(_device_target),
+  _usb_id(device_rule.getDeviceID()),
+  _name(device_rule.getName()),
+  _serial(device_rule.getSerial()),
+  _port(device_rule.getViaPort())
 {
+  for (const QString& interface : device_rule.getInterfaces()) {
+    _interfaces.append(interface);
+    _interfaces.append(QLatin1String(" "));
+  }
 }
 
 DeviceModelItem::~DeviceModelItem()
@@ -78,12 +106,19 @@ DeviceModelItem::~DeviceModelItem()
 
 void DeviceModelItem::appendChild(DeviceModelItem* child)
 {
+  child->_row = _children.count();
   _children.append(child);
 }
 
 void DeviceModelItem::removeChild(DeviceModelItem* child)
 {
-  (void)_children.takeAt(_children.indexOf(child));
+  const int row = child->_row;
+  (void)_children.takeAt(row);
+
+  /* Keep the cached position of the following siblings in sync. */
+  for (int i = row; i < _children.count(); ++i) {
+    _children[i]->_row = i;
+  }
 }
 
 DeviceModelItem* DeviceModelItem::child(int row)
@@ -105,53 +140,27 @@ QVariant DeviceModelItem::data(int column)
 {
   switch (column) {
   case 0:
-    return QVariant(_device_rule.getRuleID());
-
-  case 1:
-    return QVariant(_requested_target != _device_rule.getTarget() ? QLatin1String("*") : QString());
+    return QVariant(_device_id);
 
-  case 2:
-    switch (_requested_target) {
-    case Rule::Target::Allow:
-      return QCoreApplication::translate("DeviceModel", "Allow");
-
-    case Rule::Target::Block:
-      return QCoreApplication::translate("DeviceModel", "Block");
-
-    case Rule::Target::Reject:
-      return QCoreApplication::translate("DeviceModel", "Reject");
-
-    case Rule::Target::Unknown:
-    case Rule::Target::Empty:
-    case Rule::Target::Invalid:
-    case Rule::Target::Match:
-    case Rule::Target::Device:
-    default:
-      return QVariant(Rule::targetToString(_requested_target));
-    }
+  case 1: {
+    static const QString modified_flag = QLatin1String("*");
+    return QVariant(_requested_target != _device_target ? modified_flag : QString());
+  }
 
   case 3:
-    return QVariant(QString::fromStdString(_device_rule.getDeviceID().toString()));
+    return QVariant(_usb_id);
 
   case 4:
-    return QVariant(_device_rule.getName());
+    return QVariant(_name);
 
   case 5:
-    return QVariant(_device_rule.getSerial());
+    return QVariant(_serial);
 
   case 6:
-    return QVariant(_device_rule.getViaPort());
-
-  case 7: {
-    QString interface_string;
-
-    for (auto interface : _device_rule.attributeWithInterface().values()) {
-      interface_string.append(QString::fromStdString(interface.toRuleString()));
-      interface_string.append(QLatin1String(" "));
-    }
+    return QVariant(_port);
 
-    return QVariant(interface_string);
-  }
+  case 7:
+    return QVariant(_interfaces);
 
   default:
     return QVariant();
@@ -160,12 +169,7 @@ QVariant DeviceModelItem::data(int column)
 
 int DeviceModelItem::row() const
 {
-  if (_parent) {
-    return _parent->_children.indexOf(const_cast<DeviceModelItem*>(this));
-  }
-  else {
-    return 0;
-  }
+  return _row;
 }
 
 DeviceModelItem* DeviceModelItem::parent()
@@ -180,7 +184,7 @@ Rule::Target DeviceModelItem::getRequestedTarget() const
 
 Rule::Target DeviceModelItem::getDeviceTarget() const
 {
-  return _device_rule.getTarget();
+  return _device_target;
 }
 
 void DeviceModelItem::setRequestedTarget(Rule::Target target)
@@ -190,18 +194,45 @@ void DeviceModelItem::setRequestedTarget(Rule::Target target)
 
 void DeviceModelItem::setDeviceTarget(Rule::Target target)
 {
-  _device_rule.setTarget(target);
-  _requested_target = target;
+  _device_target = target;
+  setRequestedTarget(target);
+}
+
+QString DeviceModel::targetDisplayString(Rule::Target target)
+{
+  switch (target) {
+  case Rule::Target::Allow:
+    return QCoreApplication::translate("DeviceModel", "Allow");
+
+  case Rule::Target::Block:
+    return QCoreApplication::translate("DeviceModel", "Block");
+
+  case Rule::Target::Reject:
+    return QCoreApplication::translate("DeviceModel", "Reject");
+
+  case Rule::Target::Unknown:
+  case Rule::Target::Empty:
+  case Rule::Target::Invalid:
+  case Rule::Target::Match:
+  case Rule::Target::Device:
+  default:
+    return Rule::targetToString(target);
+  }
 }
 
-QString DeviceModelItem::getDeviceHash() const
+QByteArray DeviceModelItem::getDeviceHashKey() const
 {
-  return _device_rule.getHash();
+  return _device_hash_key;
 }
 
 quint32 DeviceModelItem::getDeviceID() const
 {
-  return _device_rule.getRuleID();
+  return _device_id;
+}
+
+QString DeviceModelItem::getDeviceName() const
+{
+  return _name;
 }
 
 DeviceModel::DeviceModel(QObject* parent)
@@ -388,6 +419,10 @@ QVariant DeviceModel::data(const QModelIndex& index, int role) const
 
   switch (role) {
   case Qt::DisplayRole:
+    if (index.column() == 2) {
+      return targetString(item->getRequestedTarget());
+    }
+
     return item->data(index.column());
 
   case RuleTarget:
@@ -423,7 +458,7 @@ bool DeviceModel::setData(const QModelIndex &index, const QVariant &value, int r
   switch (role) {
   case RuleTarget: {
     const Rule::Target target = value.value<Rule::Target>();
-    qCDebug(LOG) << "item=" << item << " target=" << target;
+    LOG_FIELDS({ "item", item }, { "target", Rule::targetToString(target) });
 
     if (item->getRequestedTarget() != target) {
       item->setRequestedTarget(target);
@@ -441,26 +476,26 @@ bool DeviceModel::setData(const QModelIndex &index, const QVariant &value, int r
   }
 }
 
-void DeviceModel::insertDevice(const Rule& device_rule)
+void DeviceModel::insertDevice(const LazyRule& device_rule)
 {
-  qCDebug(LOG) << "device_rule=" << device_rule;
+  Diagnostics::Timer timer(Diagnostics::Stage::ModelUpdate);
+  LOG_FIELDS({ "device_id", device_rule.getRuleID() }, { "device_rule", device_rule.getRuleString() });
   const uint32_t device_id = device_rule.getRuleID();
-  const QString device_hash = device_rule.getHash();
-  const QString parent_hash = device_rule.getParentHash();
-  DeviceModelItem* parent_item = _hash_map.value(parent_hash, _root_item);
+  DeviceModelItem* parent_item = _hash_map.value(device_rule.getParentHashKey(), _root_item);
   DeviceModelItem* child_item = new DeviceModelItem(device_rule, parent_item);
-  beginInsertRows(createIndex(parent_item->row(), 0, parent_item),
-    parent_item->childCount(), parent_item->childCount());
+  const QModelIndex parent_index = parent_item == _root_item ?
+    QModelIndex() : createIndex(parent_item->row(), 0, parent_item);
+  beginInsertRows(parent_index, parent_item->childCount(), parent_item->childCount());
   parent_item->appendChild(child_item);
-  _hash_map.insert(device_hash, child_item);
+  _hash_map.insert(child_item->getDeviceHashKey(), child_item);
   _id_map.insert(device_id, child_item);
   endInsertRows();
 }
 
 void DeviceModel::updateDeviceTarget(quint32 device_id, Rule::Target target)
 {
-  qCDebug(LOG) << "device_id=" << device_id
-    << " target=" << target;
+  Diagnostics::Timer timer(Diagnostics::Stage::ModelUpdate);
+  LOG_FIELDS({ "device_id", device_id }, { "target", Rule::targetToString(target) });
   DeviceModelItem* item = _id_map.value(device_id, nullptr);
 
   if (item == nullptr) {
@@ -475,9 +510,19 @@ void DeviceModel::updateDeviceTarget(quint32 device_id, Rule::Target target)
   }
 }
 
+void DeviceModel::updateDeviceTargets(const QMap<quint32, Rule::Target>& targets)
+{
+  LOG_FIELDS({ "count", targets.count() });
+
+  for (auto it = targets.constBegin(); it != targets.constEnd(); ++it) {
+    updateDeviceTarget(it.key(), it.value());
+  }
+}
+
 void DeviceModel::removeDevice(quint32 device_id)
 {
-  qCDebug(LOG) << "device_id=" << device_id;
+  Diagnostics::Timer timer(Diagnostics::Stage::ModelUpdate);
+  LOG_FIELDS({ "device_id", device_id });
   DeviceModelItem* item = _id_map.value(device_id, nullptr);
 
   if (item == nullptr) {
@@ -490,7 +535,7 @@ void DeviceModel::removeDevice(quint32 device_id)
 
 void DeviceModel::removeDevice(DeviceModelItem* item, bool notify)
 {
-  qCDebug(LOG) << "item=" << item << " notify=" << notify;
+  LOG_FIELDS({ "item", item }, { "notify", notify });
   DeviceModelItem* parent_item = item->parent();
 
   if (parent_item == nullptr) {
@@ -498,14 +543,16 @@ void DeviceModel::removeDevice(DeviceModelItem* item, bool notify)
   }
 
   if (notify) {
-    beginRemoveRows(createIndex(parent_item->row(), 0, parent_item), item->row(), item->row());
+    const QModelIndex parent_index = parent_item == _root_item ?
+      QModelIndex() : createIndex(parent_item->row(), 0, parent_item);
+    beginRemoveRows(parent_index, item->row(), item->row());
   }
 
   while (item->childCount() > 0) {
     removeDevice(item->child(0), /*notify=*/false);
   }
 
-  _hash_map.remove(item->getDeviceHash());
+  _hash_map.remove(item->getDeviceHashKey());
   _id_map.remove(item->getDeviceID());
   parent_item->removeChild(item);
   delete item;
@@ -517,7 +564,18 @@ void DeviceModel::removeDevice(DeviceModelItem* item, bool notify)
 
 bool DeviceModel::containsDevice(quint32 device_id) const
 {
-  return _id_map.count(device_id) > 0;
+  return _id_map.contains(device_id);
+}
+
+bool DeviceModel::containsDeviceHash(const QByteArray& device_hash_key) const
+{
+  return _hash_map.contains(device_hash_key);
+}
+
+QString DeviceModel::getDeviceName(const QByteArray& device_hash_key) const
+{
+  DeviceModelItem* item = _hash_map.value(device_hash_key, nullptr);
+  return item ? item->getDeviceName() : QString();
 }
 
 QModelIndex DeviceModel::createRowEditIndex(const QModelIndex& index) const
@@ -538,6 +596,140 @@ QMap<quint32, Rule::Target> DeviceModel::getModifiedDevices() const
   return modified_map;
 }
 
+void DeviceModel::reconcile(const QList<LazyRule>& devices)
+{
+  /*
+   * Bring the tree in line with a fresh device listing, touching only what
+   * differs: the views keep their state for the devices that stay.
+   */
+  Diagnostics::Timer timer(Diagnostics::Stage::ModelUpdate);
+  LOG_FIELDS({ "count", devices.count() });
+  QHash<quint32, const LazyRule*> fresh;
+  QSet<QByteArray> fresh_hash_keys;
+  fresh.reserve(devices.count());
+  fresh_hash_keys.reserve(devices.count());
+
+  for (const LazyRule& device_rule : devices) {
+    fresh.insert(device_rule.getRuleID(), &device_rule);
+    fresh_hash_keys.insert(device_rule.getHashKey());
+  }
+
+  /*
+   * Remove the devices that are gone, and the ones whose ID now names a
+   * different device or that moved to another parent; removing a device
+   * takes its subtree along, hence the lookup of every ID again.
+   */
+  const QList<quint32> known_ids = _id_map.keys();
+
+  for (const quint32 device_id : known_ids) {
+    DeviceModelItem* item = _id_map.value(device_id, nullptr);
+
+    if (item == nullptr) {
+      continue;
+    }
+
+    const LazyRule* device_rule = fresh.value(device_id, nullptr);
+    bool stale = device_rule == nullptr ||
+      device_rule->getHashKey() != item->getDeviceHashKey();
+
+    if (!stale) {
+      const QByteArray parent_key = device_rule->getParentHashKey();
+      const QByteArray expected_parent_key = fresh_hash_keys.contains(parent_key) ? parent_key : QByteArray();
+      stale = item->parent()->getDeviceHashKey() != expected_parent_key;
+    }
+
+    if (stale) {
+      removeDevice(item, /*notify=*/true);
+    }
+  }
+
+  /* Refresh the targets, dropping the changes that were not applied. */
+  for (DeviceModelItem* item : std::as_const(_id_map)) {
+    const Rule::Target target = fresh.value(item->getDeviceID())->getTarget();
+
+    if (item->getDeviceTarget() != target || item->getRequestedTarget() != target) {
+      item->setDeviceTarget(target);
+      Q_EMIT dataChanged(createIndex(item->row(), 0, item),
+        createIndex(item->row(), item->columnCount() - 1, item),
+        QVector<int>() << Qt::DisplayRole);
+    }
+  }
+
+  /*
+   * Insert the new devices, parents first; the ones whose parent is not
+   * listed go to the top level.
+   */
+  QList<const LazyRule*> missing;
+
+  for (const LazyRule& device_rule : devices) {
+    if (!_id_map.contains(device_rule.getRuleID())) {
+      missing.append(&device_rule);
+    }
+  }
+
+  while (!missing.isEmpty()) {
+    QList<const LazyRule*> waiting;
+
+    for (const LazyRule* device_rule : std::as_const(missing)) {
+      const QByteArray parent_key = device_rule->getParentHashKey();
+
+      if (fresh_hash_keys.contains(parent_key) && !_hash_map.contains(parent_key)) {
+        waiting.append(device_rule);
+      }
+      else {
+        insertDevice(*device_rule);
+      }
+    }
+
+    if (waiting.count() == missing.count()) {
+      /* A parent loop: not supposed to happen, put them at the top level. */
+      for (const LazyRule* device_rule : std::as_const(waiting)) {
+        insertDevice(*device_rule);
+      }
+
+      break;
+    }
+
+    missing = waiting;
+  }
+}
+
+const QString& DeviceModel::targetString(Rule::Target target) const
+{
+  auto it = _target_strings.find(int(target));
+
+  if (it == _target_strings.end()) {
+    it = _target_strings.insert(int(target), targetDisplayString(target));
+  }
+
+  return it.value();
+}
+
+void DeviceModel::retranslate()
+{
+  _target_strings.clear();
+  Q_EMIT headerDataChanged(Qt::Horizontal, 0, _root_item->columnCount() - 1);
+  targetColumnChanged(_root_item);
+}
+
+void DeviceModel::targetColumnChanged(DeviceModelItem* parent_item)
+{
+  const int count = parent_item->childCount();
+
+  if (count == 0) {
+    return;
+  }
+
+  const QModelIndex parent_index = parent_item == _root_item ?
+    QModelIndex() : createIndex(parent_item->row(), 0, parent_item);
+  Q_EMIT dataChanged(index(0, 2, parent_index), index(count - 1, 2, parent_index),
+    QVector<int>() << Qt::DisplayRole);
+
+  for (int row = 0; row < count; ++row) {
+    targetColumnChanged(parent_item->child(row));
+  }
+}
+
 void DeviceModel::clear()
 {
   qCDebug(LOG);
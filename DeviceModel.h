@@ -21,6 +21,9 @@
 #include "LibUsbguard.h"
 
 #include <QAbstractItemModel>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
 #include <QVariant>
 #include <QMap>
 
@@ -53,23 +56,36 @@ public:
 
   bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
 
-  void insertDevice(const Rule& device_rule);
+  void insertDevice(const LazyRule& device_rule);
   void updateDeviceTarget(quint32 device_id, Rule::Target target);
+  void updateDeviceTargets(const QMap<quint32, Rule::Target>& targets);
 
   void removeDevice(quint32 device_id);
   bool containsDevice(quint32 device_id) const;
+  /* The keys are the ones of LazyRule::getHashKey(). */
+  bool containsDeviceHash(const QByteArray& device_hash_key) const;
+  QString getDeviceName(const QByteArray& device_hash_key) const;
 
   QModelIndex createRowEditIndex(const QModelIndex& index) const;
   QMap<quint32, Rule::Target> getModifiedDevices() const;
 
+  void reconcile(const QList<LazyRule>& devices);
   void clear();
 
+  /* Call on QEvent::LanguageChange, to drop the translated strings. */
+  void retranslate();
+
 private:
   void removeDevice(DeviceModelItem* item, bool notify = false);
+  const QString& targetString(Rule::Target target) const;
+  void targetColumnChanged(DeviceModelItem* parent_item);
+
+  static QString targetDisplayString(Rule::Target target);
 
-  QMap<QString, DeviceModelItem*> _hash_map;
-  QMap<uint32_t, DeviceModelItem*> _id_map;
+  QHash<QByteArray, DeviceModelItem*> _hash_map;
+  QHash<uint32_t, DeviceModelItem*> _id_map;
   DeviceModelItem* _root_item;
+  mutable QHash<int, QString> _target_strings;
 };
 
 /* vim: set ts=2 sw=2 et */
@@ -0,0 +1,241 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+
+#include "Diagnostics.h"
+#include "Log.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+
+#include <atomic>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+  struct StageStats
+  {
+    std::atomic<quint64> count{ 0 };
+    std::atomic<quint64> total{ 0 };  /* nsecs */
+    std::atomic<quint64> max{ 0 };    /* nsecs */
+    std::atomic<quint64> buckets[Diagnostics::BucketCount] = {};
+  };
+
+  StageStats stats[Diagnostics::StageCount];
+
+  int bucketFor(qint64 nsecs)
+  {
+    quint64 usecs = quint64(nsecs) / 1000;
+    int bucket = 0;
+
+    while (usecs > 1 && bucket < Diagnostics::BucketCount - 1) {
+      usecs >>= 1;
+      ++bucket;
+    }
+
+    return bucket;
+  }
+}
+
+int Diagnostics::_signal_fds[2] = { -1, -1 };
+
+Diagnostics::Timer::Timer(Stage stage) :
+  _stage(stage)
+{
+  _timer.start();
+}
+
+Diagnostics::Timer::~Timer()
+{
+  Diagnostics::record(_stage, _timer.nsecsElapsed());
+}
+
+Diagnostics::Diagnostics(QObject* parent) :
+  QObject(parent)
+{
+}
+
+Diagnostics::~Diagnostics()
+{
+  if (_signal_notifier) {
+    ::signal(SIGUSR1, SIG_DFL);
+    ::close(_signal_fds[0]);
+    ::close(_signal_fds[1]);
+    _signal_fds[0] = _signal_fds[1] = -1;
+  }
+}
+
+void Diagnostics::record(Stage stage, qint64 nsecs)
+{
+  if (nsecs < 0) {
+    return;
+  }
+
+  StageStats& stage_stats = stats[int(stage)];
+  stage_stats.count.fetch_add(1, std::memory_order_relaxed);
+  stage_stats.total.fetch_add(quint64(nsecs), std::memory_order_relaxed);
+  stage_stats.buckets[bucketFor(nsecs)].fetch_add(1, std::memory_order_relaxed);
+  quint64 max = stage_stats.max.load(std::memory_order_relaxed);
+
+  while (quint64(nsecs) > max &&
+    !stage_stats.max.compare_exchange_weak(max, quint64(nsecs), std::memory_order_relaxed)) {
+  }
+}
+
+QString Diagnostics::stageName(Stage stage)
+{
+  switch (stage) {
+  case Stage::SignalReceive:
+    return QLatin1String("signal_receive");
+
+  case Stage::RuleParse:
+    return QLatin1String("rule_parse");
+
+  case Stage::ModelUpdate:
+    return QLatin1String("model_update");
+
+  case Stage::ViewRelayout:
+    return QLatin1String("view_relayout");
+
+  case Stage::Notification:
+    return QLatin1String("notification");
+
+  default:
+    return QString::number(int(stage));
+  }
+}
+
+QJsonObject Diagnostics::toJson()
+{
+  QJsonObject stages;
+
+  for (int i = 0; i < StageCount; ++i) {
+    const StageStats& stage_stats = stats[i];
+    const quint64 count = stage_stats.count.load(std::memory_order_relaxed);
+    const quint64 total = stage_stats.total.load(std::memory_order_relaxed);
+    QJsonArray histogram;
+    int last_bucket = -1;
+
+    for (int bucket = 0; bucket < BucketCount; ++bucket) {
+      if (stage_stats.buckets[bucket].load(std::memory_order_relaxed) > 0) {
+        last_bucket = bucket;
+      }
+    }
+
+    for (int bucket = 0; bucket <= last_bucket; ++bucket) {
+      histogram.append(qint64(stage_stats.buckets[bucket].load(std::memory_order_relaxed)));
+    }
+
+    QJsonObject stage;
+    stage.insert(QLatin1String("count"), qint64(count));
+    stage.insert(QLatin1String("total_us"), qint64(total / 1000));
+    stage.insert(QLatin1String("mean_us"), count > 0 ? double(total) / count / 1000 : 0.0);
+    stage.insert(QLatin1String("max_us"), qint64(stage_stats.max.load(std::memory_order_relaxed) / 1000));
+    stage.insert(QLatin1String("histogram_log2_us"), histogram);
+    stages.insert(stageName(Stage(i)), stage);
+  }
+
+  QJsonObject result;
+  result.insert(QLatin1String("pid"), qint64(::getpid()));
+  result.insert(QLatin1String("time"), QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs));
+  result.insert(QLatin1String("stages"), stages);
+  return result;
+}
+
+bool Diagnostics::installSignalHandler()
+{
+  if (_signal_notifier) {
+    return true;
+  }
+
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, _signal_fds) != 0) {
+    qCDebug(LOG) << "Cannot create the diagnostics socket pair";
+    return false;
+  }
+
+  struct sigaction action = {};
+  action.sa_handler = &Diagnostics::signalHandler;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+
+  if (::sigaction(SIGUSR1, &action, nullptr) != 0) {
+    qCDebug(LOG) << "Cannot install the SIGUSR1 handler";
+    ::close(_signal_fds[0]);
+    ::close(_signal_fds[1]);
+    _signal_fds[0] = _signal_fds[1] = -1;
+    return false;
+  }
+
+  _signal_notifier = new QSocketNotifier(_signal_fds[1], QSocketNotifier::Read, this);
+  QObject::connect(_signal_notifier, &QSocketNotifier::activated,
+    this, &Diagnostics::handleSignal);
+  return true;
+}
+
+void Diagnostics::signalHandler(int signal)
+{
+  (void)signal;
+  const char byte = 1;
+  /* Nothing to do if the socket is full: a dump is already pending. */
+  const ssize_t written = ::write(_signal_fds[0], &byte, sizeof(byte));
+  (void)written;
+}
+
+void Diagnostics::handleSignal()
+{
+  char bytes[16];
+
+  while (::read(_signal_fds[1], bytes, sizeof(bytes)) > 0) {
+  }
+
+  dump();
+}
+
+QString Diagnostics::dumpPath() const
+{
+  return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) +
+    QLatin1String("/diagnostics.json");
+}
+
+bool Diagnostics::dump()
+{
+  const QString path = dumpPath();
+  QDir().mkpath(QFileInfo(path).absolutePath());
+  QSaveFile file(path);
+
+  if (!file.open(QIODevice::WriteOnly) ||
+    file.write(QJsonDocument(toJson()).toJson()) < 0 ||
+    !file.commit()) {
+    qCWarning(LOG) << "Cannot write the diagnostics to" << path;
+    return false;
+  }
+
+  qCDebug(LOG) << "Diagnostics written to" << path;
+  return true;
+}
+
+/* vim: set ts=2 sw=2 et */
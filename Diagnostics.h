@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+#pragma once
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QObject>
+#include <QString>
+
+class QSocketNotifier;
+
+/*
+ * Counters and latency histograms of the stages a device event goes
+ * through, from the D-Bus signal to the notification. Recording is a few
+ * relaxed atomic operations, so it is always on.
+ *
+ * The histograms have one bucket per power of two of microseconds: bucket
+ * N counts the samples in [2^N, 2^(N+1)) us, and bucket 0 also the ones
+ * below 1 us.
+ */
+class Diagnostics : public QObject
+{
+  Q_OBJECT
+
+public:
+  enum class Stage {
+    SignalReceive = 0,
+    RuleParse,
+    ModelUpdate,
+    ViewRelayout,
+    Notification,
+  };
+
+  static const int StageCount = 5;
+  static const int BucketCount = 24;
+
+  /* Records the time between its creation and its destruction. */
+  class Timer
+  {
+  public:
+    explicit Timer(Stage stage);
+    ~Timer();
+
+  private:
+    Stage _stage;
+    QElapsedTimer _timer;
+  };
+
+  explicit Diagnostics(QObject* parent = nullptr);
+  ~Diagnostics();
+
+  static void record(Stage stage, qint64 nsecs);
+  static QString stageName(Stage stage);
+  static QJsonObject toJson();
+
+  /*
+   * Dumps the statistics to a JSON file when the process receives SIGUSR1.
+   * The handler only writes to a socket; the dump is done in the event
+   * loop.
+   */
+  bool installSignalHandler();
+  QString dumpPath() const;
+
+public Q_SLOTS:
+  bool dump();
+
+private Q_SLOTS:
+  void handleSignal();
+
+private:
+  static void signalHandler(int signal);
+  static int _signal_fds[2];
+
+  QSocketNotifier* _signal_notifier = nullptr;
+};
+
+/* vim: set ts=2 sw=2 et */
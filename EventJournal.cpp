@@ -0,0 +1,571 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+
+#include "EventJournal.h"
+#include "Log.h"
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QStandardPaths>
+
+#include <cstring>
+#include <limits>
+
+static_assert(sizeof(EventJournal::Record) == 32, "journal records must stay 32 bytes");
+static_assert(sizeof(EventJournal::Header) == 16, "journal headers must stay 16 bytes");
+
+const quint32 EventJournal::RecordsMagic = 0x4a475355; /* "USGJ" */
+const quint32 EventJournal::StringsMagic = 0x53475355; /* "USGS" */
+const quint32 EventJournal::Version = 1;
+
+EventJournal::EventJournal(QObject* parent) :
+  QObject(parent),
+  _directory(defaultDirectory()),
+  _flush_timer(this)
+{
+  _flush_timer.setInterval(FlushInterval);
+  _flush_timer.setSingleShot(true);
+  QObject::connect(&_flush_timer, &QTimer::timeout, this, &EventJournal::flush);
+}
+
+EventJournal::~EventJournal()
+{
+  flush();
+}
+
+QString EventJournal::defaultDirectory()
+{
+  return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+}
+
+QString EventJournal::recordsPath() const
+{
+  return _directory + QLatin1String("/journal.bin");
+}
+
+QString EventJournal::stringsPath() const
+{
+  return _directory + QLatin1String("/journal-strings.bin");
+}
+
+bool EventJournal::open()
+{
+  if (isOpen()) {
+    return true;
+  }
+
+  if (_directory.isEmpty() || !QDir().mkpath(_directory)) {
+    qCDebug(LOG) << "Cannot create the journal directory" << _directory;
+    return false;
+  }
+
+  _records_file.setFileName(recordsPath());
+  _strings_file.setFileName(stringsPath());
+
+  if (!openFile(_strings_file, StringsMagic) || !loadStrings() ||
+    !openFile(_records_file, RecordsMagic)) {
+    _records_file.close();
+    _strings_file.close();
+    _strings.clear();
+    return false;
+  }
+
+  qCDebug(LOG) << "Journal opened:" << recordsPath()
+    << "interned strings:" << _strings.size();
+  return true;
+}
+
+bool EventJournal::isOpen() const
+{
+  return _records_file.isOpen() && _strings_file.isOpen();
+}
+
+bool EventJournal::openFile(QFile& file, quint32 magic)
+{
+  /*
+   * Unbuffered, so that a record reaches the file as soon as it is
+   * appended, and the viewer can map it right away.
+   */
+  if (!file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+    qCDebug(LOG) << "Cannot open" << file.fileName() << ":" << file.errorString();
+    return false;
+  }
+
+  Header header;
+
+  if (file.size() == 0) {
+    header.magic = magic;
+    header.version = Version;
+    header.record_size = magic == RecordsMagic ? sizeof(Record) : 0;
+    header.reserved = 0;
+
+    if (file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)) {
+      qCDebug(LOG) << "Cannot write" << file.fileName() << ":" << file.errorString();
+      file.close();
+      return false;
+    }
+
+    return true;
+  }
+
+  if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+    header.magic != magic || header.version != Version ||
+    (magic == RecordsMagic && header.record_size != sizeof(Record))) {
+    qCDebug(LOG) << "Unsupported journal file:" << file.fileName();
+    file.close();
+    return false;
+  }
+
+  if (magic == RecordsMagic) {
+    /* Drop a record left half-written by a crash. */
+    const qint64 records_size = file.size() - sizeof(Header);
+    const qint64 tail = records_size % sizeof(Record);
+
+    if (tail != 0) {
+      file.resize(file.size() - tail);
+    }
+  }
+
+  file.seek(file.size());
+  return true;
+}
+
+bool EventJournal::loadStrings()
+{
+  const qint64 size = _strings_file.size();
+  uchar* const data = _strings_file.map(0, size);
+
+  if (data == nullptr) {
+    qCDebug(LOG) << "Cannot map" << _strings_file.fileName();
+    return false;
+  }
+
+  qint64 offset = sizeof(Header);
+
+  while (offset + qint64(sizeof(quint32)) <= size) {
+    quint32 length;
+    std::memcpy(&length, data + offset, sizeof(length));
+
+    if (offset + qint64(sizeof(length)) + length > size) {
+      break;
+    }
+
+    const char* const bytes = reinterpret_cast<const char*>(data + offset + sizeof(length));
+    _strings.insert(QString::fromUtf8(bytes, length), quint32(offset));
+    offset += sizeof(length) + length;
+  }
+
+  _strings_file.unmap(data);
+
+  if (offset != size) {
+    /* Same as for the records, drop an incomplete trailing string. */
+    _strings_file.resize(offset);
+  }
+
+  _strings_file.seek(offset);
+  _strings_end = offset;
+  return true;
+}
+
+quint32 EventJournal::internString(const QString& string)
+{
+  /* Offset 0 is the header, so it can stand for the empty string. */
+  if (string.isEmpty()) {
+    return 0;
+  }
+
+  const auto it = _strings.constFind(string);
+
+  if (it != _strings.constEnd()) {
+    return it.value();
+  }
+
+  const qint64 offset = _strings_end;
+
+  if (offset > std::numeric_limits<quint32>::max()) {
+    return 0;
+  }
+
+  const QByteArray bytes = string.toUtf8();
+  const quint32 length = bytes.size();
+  _pending_strings.append(reinterpret_cast<const char*>(&length), sizeof(length));
+  _pending_strings.append(bytes);
+  _strings_end += sizeof(length) + length;
+  _strings.insert(string, quint32(offset));
+  return quint32(offset);
+}
+
+void EventJournal::append(Event event, const LazyRule& device_rule)
+{
+  if (!isOpen()) {
+    return;
+  }
+
+  Record record;
+  std::memset(&record, 0, sizeof(record));
+  record.timestamp = QDateTime::currentMSecsSinceEpoch();
+  record.device_id = device_rule.getRuleID();
+  record.usb_id = internString(device_rule.getDeviceID());
+  record.name = internString(device_rule.getName());
+  record.port = internString(device_rule.getViaPort());
+  record.event = quint8(event);
+  record.target = quint8(device_rule.getTarget());
+
+  _pending_records.append(reinterpret_cast<const char*>(&record), sizeof(record));
+
+  if (_pending_records.size() >= MaxPendingRecords * qsizetype(sizeof(Record))) {
+    flush();
+  }
+  else if (!_flush_timer.isActive()) {
+    _flush_timer.start();
+  }
+}
+
+void EventJournal::flush()
+{
+  _flush_timer.stop();
+
+  if (_pending_records.isEmpty() && _pending_strings.isEmpty()) {
+    return;
+  }
+
+  /*
+   * The strings go first: a reader that sees the records can always
+   * resolve their string offsets. When a write fails, both files go back
+   * to their previous size, and the pending records are lost.
+   */
+  const qint64 strings_size = _strings_file.pos();
+  const qint64 records_size = _records_file.pos();
+  bool written = true;
+
+  if (_strings_file.write(_pending_strings) != _pending_strings.size()) {
+    qCDebug(LOG) << "Cannot write" << _strings_file.fileName() << ":" << _strings_file.errorString();
+    written = false;
+  }
+  else if (_records_file.write(_pending_records) != _pending_records.size()) {
+    qCDebug(LOG) << "Cannot write" << _records_file.fileName() << ":" << _records_file.errorString();
+    written = false;
+  }
+
+  _pending_strings.clear();
+  _pending_records.clear();
+
+  if (!written) {
+    _strings_file.resize(strings_size);
+    _strings_file.seek(strings_size);
+    _records_file.resize(records_size);
+    _records_file.seek(records_size);
+    _strings_end = strings_size;
+
+    for (auto it = _strings.begin(); it != _strings.end();) {
+      if (it.value() >= strings_size) {
+        it = _strings.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+
+    return;
+  }
+
+  Q_EMIT appended();
+}
+
+EventJournalModel::EventJournalModel(EventJournal* journal, QObject* parent) :
+  QAbstractTableModel(parent),
+  _journal(journal),
+  _reload_timer(this)
+{
+  /* A burst of events is one reload, not one per record. */
+  _reload_timer.setInterval(ReloadInterval);
+  _reload_timer.setSingleShot(true);
+  QObject::connect(&_reload_timer, &QTimer::timeout,
+    this, &EventJournalModel::reload);
+  QObject::connect(_journal, &EventJournal::appended,
+    this, &EventJournalModel::scheduleReload);
+}
+
+EventJournalModel::~EventJournalModel()
+{
+  unmap();
+}
+
+QVariant EventJournalModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+  if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+    return QVariant();
+  }
+
+  switch (section) {
+  case 0:
+    return tr("Time");
+
+  case 1:
+    return tr("Event");
+
+  case 2:
+    return tr("Target");
+
+  case 3:
+    return tr("USB ID");
+
+  case 4:
+    return tr("Name");
+
+  case 5:
+    return tr("Port");
+
+  default:
+    return QVariant();
+  }
+}
+
+int EventJournalModel::rowCount(const QModelIndex& parent) const
+{
+  if (parent.isValid()) {
+    return 0;
+  }
+
+  return _count;
+}
+
+int EventJournalModel::columnCount(const QModelIndex& parent) const
+{
+  if (parent.isValid()) {
+    return 0;
+  }
+
+  return 6;
+}
+
+QVariant EventJournalModel::data(const QModelIndex& index, int role) const
+{
+  if (!index.isValid() || index.row() >= _count || role != Qt::DisplayRole) {
+    return QVariant();
+  }
+
+  EventJournal::Record record;
+  std::memcpy(&record,
+    _records + sizeof(EventJournal::Header) + qint64(index.row()) * sizeof(record),
+    sizeof(record));
+
+  switch (index.column()) {
+  case 0:
+    return QDateTime::fromMSecsSinceEpoch(record.timestamp).toString();
+
+  case 1:
+    return eventDisplayString(record.event);
+
+  case 2:
+    switch (Rule::Target(record.target)) {
+    case Rule::Target::Allow:
+      return QCoreApplication::translate("DeviceModel", "Allow");
+
+    case Rule::Target::Block:
+      return QCoreApplication::translate("DeviceModel", "Block");
+
+    case Rule::Target::Reject:
+      return QCoreApplication::translate("DeviceModel", "Reject");
+
+    default:
+      return Rule::targetToString(Rule::Target(record.target));
+    }
+
+  case 3:
+    return stringAt(record.usb_id);
+
+  case 4:
+    return stringAt(record.name);
+
+  case 5:
+    return stringAt(record.port);
+
+  default:
+    return QVariant();
+  }
+}
+
+void EventJournalModel::scheduleReload()
+{
+  if (!_reload_timer.isActive()) {
+    _reload_timer.start();
+  }
+}
+
+void EventJournalModel::reload()
+{
+  /*
+   * The files only ever grow, so the rows already shown stay valid: keep
+   * the files open, map them again only when they grew, and announce the
+   * new rows at the end.
+   */
+  _reload_timer.stop();
+
+  if (!_journal->isOpen()) {
+    unmap();
+    resetRows();
+    return;
+  }
+
+  if (!_records_file.isOpen() || !_strings_file.isOpen()) {
+    _records_file.setFileName(_journal->recordsPath());
+    _strings_file.setFileName(_journal->stringsPath());
+
+    if (!openFile(_records_file, EventJournal::RecordsMagic) ||
+      !openFile(_strings_file, EventJournal::StringsMagic)) {
+      unmap();
+      resetRows();
+      return;
+    }
+  }
+
+  /* The strings are written first, so they resolve all the records seen. */
+  if (!remapFile(_strings_file, _strings, _strings_size) ||
+    !remapFile(_records_file, _records, _records_size)) {
+    unmap();
+    resetRows();
+    return;
+  }
+
+  const qint64 count = (_records_size - qint64(sizeof(EventJournal::Header))) / qint64(sizeof(EventJournal::Record));
+  const int new_count = int(qMin<qint64>(count, std::numeric_limits<int>::max()));
+
+  if (new_count > _count) {
+    beginInsertRows(QModelIndex(), _count, new_count - 1);
+    _count = new_count;
+    endInsertRows();
+  }
+  else if (new_count < _count) {
+    beginResetModel();
+    _count = new_count;
+    endResetModel();
+  }
+}
+
+void EventJournalModel::unmap()
+{
+  if (_records != nullptr) {
+    _records_file.unmap(const_cast<uchar*>(_records));
+    _records = nullptr;
+  }
+
+  if (_strings != nullptr) {
+    _strings_file.unmap(const_cast<uchar*>(_strings));
+    _strings = nullptr;
+  }
+
+  _records_file.close();
+  _strings_file.close();
+  _records_size = 0;
+  _strings_size = 0;
+}
+
+void EventJournalModel::resetRows()
+{
+  if (_count > 0) {
+    beginResetModel();
+    _count = 0;
+    endResetModel();
+  }
+}
+
+bool EventJournalModel::openFile(QFile& file, quint32 magic)
+{
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+
+  EventJournal::Header header;
+
+  if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+    header.magic != magic || header.version != EventJournal::Version) {
+    file.close();
+    return false;
+  }
+
+  return true;
+}
+
+bool EventJournalModel::remapFile(QFile& file, const uchar*& data, qint64& size)
+{
+  const qint64 new_size = file.size();
+
+  if (data != nullptr && new_size == size) {
+    return true;
+  }
+
+  if (data != nullptr) {
+    file.unmap(const_cast<uchar*>(data));
+  }
+
+  data = file.map(0, new_size);
+  size = data != nullptr ? new_size : 0;
+  return data != nullptr;
+}
+
+QString EventJournalModel::stringAt(quint32 offset) const
+{
+  if (offset < sizeof(EventJournal::Header) ||
+    qint64(offset) + qint64(sizeof(quint32)) > _strings_size) {
+    return QString();
+  }
+
+  quint32 length;
+  std::memcpy(&length, _strings + offset, sizeof(length));
+
+  if (qint64(offset) + qint64(sizeof(length)) + length > _strings_size) {
+    return QString();
+  }
+
+  return QString::fromUtf8(reinterpret_cast<const char*>(_strings + offset + sizeof(length)), length);
+}
+
+QString EventJournalModel::eventDisplayString(quint8 event)
+{
+  switch (EventJournal::Event(event)) {
+  case EventJournal::Event::Inserted:
+    return tr("Inserted");
+
+  case EventJournal::Event::Updated:
+    return tr("Updated");
+
+  case EventJournal::Event::Removed:
+    return tr("Removed");
+
+  case EventJournal::Event::Present:
+    return tr("Present");
+
+  case EventJournal::Event::Allowed:
+    return tr("Allowed");
+
+  case EventJournal::Event::Blocked:
+    return tr("Blocked");
+
+  case EventJournal::Event::Rejected:
+    return tr("Rejected");
+
+  default:
+    return QString::number(event);
+  }
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,168 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+#pragma once
+
+#include "LibUsbguard.h"
+
+#include <QAbstractTableModel>
+#include <QFile>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVariant>
+
+/*
+ * Append-only journal of the device events, stored in two files in the
+ * application data directory:
+ *
+ *  - journal.bin: a header followed by fixed-size records, so that the
+ *    record N is found at a known offset without reading the others;
+ *  - journal-strings.bin: a header followed by the strings referenced by
+ *    the records, each stored once as a length-prefixed UTF-8 string;
+ *    a record refers to a string by its offset in this file.
+ *
+ * Both files are in host byte order, as they never leave the machine.
+ *
+ * The appended records are kept in memory, and written at most once per
+ * FlushInterval, or when MaxPendingRecords are pending: a burst of events
+ * costs a couple of writes, not a few per event.
+ */
+class EventJournal : public QObject
+{
+  Q_OBJECT
+
+public:
+  enum class Event : quint8 {
+    Inserted = 0,
+    Updated = 1,
+    Removed = 2,
+    Present = 3,
+    Allowed = 4,
+    Blocked = 5,
+    Rejected = 6,
+  };
+
+  struct Record
+  {
+    qint64 timestamp;   /* msecs since epoch, UTC */
+    quint32 device_id;
+    quint32 usb_id;     /* string offset */
+    quint32 name;       /* string offset */
+    quint32 port;       /* string offset */
+    quint8 event;       /* Event */
+    quint8 target;      /* Rule::Target */
+    quint16 reserved0;
+    quint32 reserved1;
+  };
+
+  struct Header
+  {
+    quint32 magic;
+    quint32 version;
+    quint32 record_size;
+    quint32 reserved;
+  };
+
+  static const quint32 RecordsMagic;
+  static const quint32 StringsMagic;
+  static const quint32 Version;
+  static const int FlushInterval = 250; /* msecs */
+  static const int MaxPendingRecords = 256;
+
+  explicit EventJournal(QObject* parent = nullptr);
+  ~EventJournal();
+
+  bool open();
+  bool isOpen() const;
+
+  QString recordsPath() const;
+  QString stringsPath() const;
+
+  void append(Event event, const LazyRule& device_rule);
+  void flush();
+
+  static QString defaultDirectory();
+
+Q_SIGNALS:
+  void appended();
+
+private:
+  bool openFile(QFile& file, quint32 magic);
+  bool loadStrings();
+  quint32 internString(const QString& string);
+
+  QString _directory;
+  QFile _records_file;
+  QFile _strings_file;
+  QHash<QString, quint32> _strings;
+  qint64 _strings_end = 0;
+  QByteArray _pending_strings;
+  QByteArray _pending_records;
+  QTimer _flush_timer;
+};
+
+/*
+ * Read-only view of the journal. Both files are memory mapped, and the
+ * rows are decoded only when the view asks for them, so the size of the
+ * journal does not matter. The appended records are picked up at most once
+ * per ReloadInterval, growing the mappings only when the files grew.
+ * The model is empty until the first reload(), which is up to the owner
+ * once the journal is open.
+ */
+class EventJournalModel : public QAbstractTableModel
+{
+  Q_OBJECT
+
+public:
+  static const int ReloadInterval = 250; /* msecs */
+
+  explicit EventJournalModel(EventJournal* journal, QObject* parent = nullptr);
+  ~EventJournalModel();
+
+  QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+  int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+public Q_SLOTS:
+  void reload();
+
+private:
+  void scheduleReload();
+  void unmap();
+  void resetRows();
+  static bool openFile(QFile& file, quint32 magic);
+  static bool remapFile(QFile& file, const uchar*& data, qint64& size);
+  QString stringAt(quint32 offset) const;
+
+  static QString eventDisplayString(quint8 event);
+
+  EventJournal* _journal;
+  QFile _records_file;
+  QFile _strings_file;
+  const uchar* _records = nullptr;
+  const uchar* _strings = nullptr;
+  qint64 _records_size = 0;
+  qint64 _strings_size = 0;
+  int _count = 0;
+  QTimer _reload_timer;
+};
+
+/* vim: set ts=2 sw=2 et */
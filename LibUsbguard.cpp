@@ -18,8 +18,13 @@
 //
 
 #include "LibUsbguard.h"
+#include "Diagnostics.h"
+#include "Log.h"
 
+#include <QByteArray>
+#include <QCache>
 #include <QDebug>
+#include <QMutex>
 
 #include <limits>
 
@@ -96,8 +101,32 @@ QString Rule::toString() const
 
 Rule Rule::fromString(const QString& str)
 {
+  /*
+   * The same device rule is received several times (presence and policy
+   * signals, device listings), so keep the most recently parsed ones.
+   */
+  static QCache<QString, Rule> cache(256);
+  static quint64 hits = 0;
+  static quint64 misses = 0;
+  /* Rules are parsed both by the D-Bus worker and the GUI thread. */
+  static QMutex mutex;
+
+  {
+    QMutexLocker locker(&mutex);
+
+    if (const Rule* cached = cache.object(str)) {
+      ++hits;
+      qCDebug(LOG) << "Rule cache hit: hits=" << hits << " misses=" << misses;
+      return *cached;
+    }
+  }
+
   Rule r;
   r._rule = usbguard::Rule::fromString(str.toStdString());
+  QMutexLocker locker(&mutex);
+  cache.insert(str, new Rule(r));
+  ++misses;
+  qCDebug(LOG) << "Rule cache miss: hits=" << hits << " misses=" << misses;
   return r;
 }
 
@@ -106,6 +135,315 @@ QString Rule::targetToString(Rule::Target target)
   return QString::fromStdString(usbguard::Rule::targetToString(static_cast<usbguard::Rule::Target>(target)));
 }
 
+LazyRule::LazyRule() :
+  _rule_id(0)
+{
+}
+
+LazyRule::LazyRule(const QString& rule_string) :
+  _rule_string(rule_string),
+  _rule_id(0)
+{
+}
+
+LazyRule::LazyRule(const QString& rule_string, Rule::Target target, const QMap<QString, QString>& attributes) :
+  _rule_string(rule_string),
+  _rule_id(0)
+{
+  // Without the attributes, fall back to scanning the rule text.
+  if (!attributes.contains(QLatin1String("id")) || !attributes.contains(QLatin1String("hash"))) {
+    return;
+  }
+
+  Attributes a;
+  a.target = target;
+  a.device_id = attributes.value(QLatin1String("id"));
+  a.hash = attributes.value(QLatin1String("hash"));
+  a.name = attributes.value(QLatin1String("name"));
+  a.parent_hash = attributes.value(QLatin1String("parent-hash"));
+  a.hash_key = hashKey(a.hash);
+  a.parent_hash_key = hashKey(a.parent_hash);
+  a.serial = attributes.value(QLatin1String("serial"));
+  a.via_port = attributes.value(QLatin1String("via-port"));
+
+  // The value may be a set, e.g. "{ 03:01:01 03:00:00 }".
+  const QStringList interfaces = attributes.value(QLatin1String("with-interface"))
+    .split(QLatin1Char(' '), Qt::SkipEmptyParts);
+
+  for (const QString& interface : interfaces) {
+    if (interface.contains(QLatin1Char(':'))) {
+      a.interfaces.append(interface);
+    }
+  }
+
+  _attributes = a;
+}
+
+LazyRule::~LazyRule()
+{
+}
+
+QString LazyRule::getDeviceID() const
+{
+  return attributes().device_id;
+}
+
+QString LazyRule::getHash() const
+{
+  return attributes().hash;
+}
+
+QByteArray LazyRule::getHashKey() const
+{
+  return attributes().hash_key;
+}
+
+QStringList LazyRule::getInterfaces() const
+{
+  return attributes().interfaces;
+}
+
+QString LazyRule::getName() const
+{
+  return attributes().name;
+}
+
+QString LazyRule::getParentHash() const
+{
+  return attributes().parent_hash;
+}
+
+QByteArray LazyRule::getParentHashKey() const
+{
+  return attributes().parent_hash_key;
+}
+
+uint32_t LazyRule::getRuleID() const
+{
+  return _rule_id;
+}
+
+QString LazyRule::getSerial() const
+{
+  return attributes().serial;
+}
+
+Rule::Target LazyRule::getTarget() const
+{
+  return attributes().target;
+}
+
+QString LazyRule::getViaPort() const
+{
+  return attributes().via_port;
+}
+
+const QString& LazyRule::getRuleString() const
+{
+  return _rule_string;
+}
+
+void LazyRule::setRuleID(uint32_t rule_id)
+{
+  _rule_id = rule_id;
+
+  if (_rule) {
+    _rule->setRuleID(rule_id);
+  }
+}
+
+const Rule& LazyRule::rule() const
+{
+  if (!_rule) {
+    Diagnostics::Timer timer(Diagnostics::Stage::RuleParse);
+    _rule = Rule::fromString(_rule_string);
+    _rule->setRuleID(_rule_id);
+  }
+
+  return *_rule;
+}
+
+// Reverts the escaping done by usbguard for the quoted strings of a rule.
+static QString unescapeRuleString(const QByteArray& escaped)
+{
+  QByteArray bytes;
+  bytes.reserve(escaped.size());
+
+  for (qsizetype i = 0; i < escaped.size(); ++i) {
+    const char c = escaped.at(i);
+
+    if (c != '\\' || i + 1 >= escaped.size()) {
+      bytes.append(c);
+      continue;
+    }
+
+    const char next = escaped.at(++i);
+
+    if (next == 'x' && i + 2 < escaped.size()) {
+      bool ok = false;
+      const int value = escaped.mid(i + 1, 2).toInt(&ok, 16);
+
+      if (ok) {
+        bytes.append(static_cast<char>(value));
+        i += 2;
+        continue;
+      }
+    }
+
+    bytes.append(next);
+  }
+
+  return QString::fromUtf8(bytes);
+}
+
+static Rule::Target targetFromRuleString(const QByteArray& target)
+{
+  if (target == "allow") {
+    return Rule::Target::Allow;
+  }
+  else if (target == "block") {
+    return Rule::Target::Block;
+  }
+  else if (target == "reject") {
+    return Rule::Target::Reject;
+  }
+  else if (target == "match") {
+    return Rule::Target::Match;
+  }
+  else if (target == "device") {
+    return Rule::Target::Device;
+  }
+  else {
+    return Rule::Target::Invalid;
+  }
+}
+
+const LazyRule::Attributes& LazyRule::attributes() const
+{
+  if (_attributes) {
+    return *_attributes;
+  }
+
+  /*
+   * A device rule is the target followed by "key value" pairs, where the
+   * values of the attributes scanned here are single tokens or quoted
+   * strings; only with-interface can also be a set, "[operator] { ... }".
+   * Other sets of values are skipped token by token.
+   */
+  Diagnostics::Timer timer(Diagnostics::Stage::RuleParse);
+  Attributes attributes;
+  const QByteArray rule = _rule_string.toUtf8();
+  const qsizetype size = rule.size();
+  QByteArray key;
+  bool interface_set = false;
+  bool first_token = true;
+  qsizetype i = 0;
+
+  while (i < size) {
+    while (i < size && rule.at(i) == ' ') {
+      ++i;
+    }
+
+    if (i >= size) {
+      break;
+    }
+
+    QByteArray token;
+    bool quoted = false;
+
+    if (rule.at(i) == '"') {
+      const qsizetype start = ++i;
+
+      while (i < size && rule.at(i) != '"') {
+        i += (rule.at(i) == '\\') ? 2 : 1;
+      }
+
+      token = rule.mid(start, qMin(i, size) - start);
+      quoted = true;
+      ++i;
+    }
+    else {
+      const qsizetype start = i;
+
+      while (i < size && rule.at(i) != ' ') {
+        ++i;
+      }
+
+      token = rule.mid(start, i - start);
+    }
+
+    if (first_token) {
+      attributes.target = targetFromRuleString(token);
+      first_token = false;
+    }
+    else if (interface_set) {
+      if (token == "}") {
+        interface_set = false;
+      }
+      else {
+        attributes.interfaces.append(QString::fromUtf8(token));
+      }
+    }
+    else if (key == "with-interface" && !quoted && !token.contains(':')) {
+      // An operator (e.g. one-of) or the start of a set of values.
+      interface_set = (token == "{");
+
+      if (interface_set) {
+        key.clear();
+      }
+    }
+    else if (!key.isEmpty()) {
+      const QString value = quoted ? unescapeRuleString(token) : QString::fromUtf8(token);
+
+      if (key == "id") {
+        attributes.device_id = value;
+      }
+      else if (key == "hash") {
+        attributes.hash = value;
+      }
+      else if (key == "name") {
+        attributes.name = value;
+      }
+      else if (key == "parent-hash") {
+        attributes.parent_hash = value;
+      }
+      else if (key == "serial") {
+        attributes.serial = value;
+      }
+      else if (key == "via-port") {
+        attributes.via_port = value;
+      }
+      else if (key == "with-interface") {
+        attributes.interfaces.append(value);
+      }
+
+      key.clear();
+    }
+    else if (!quoted && (token == "id" || token == "hash" || token == "name" ||
+        token == "parent-hash" || token == "serial" || token == "via-port" ||
+        token == "with-interface")) {
+      key = token;
+    }
+  }
+
+  attributes.hash_key = hashKey(attributes.hash);
+  attributes.parent_hash_key = hashKey(attributes.parent_hash);
+  _attributes = attributes;
+  return *_attributes;
+}
+
+/*
+ * Device hashes are base64-encoded digests; the decoded digest is shorter
+ * and cheaper to hash and compare than the encoded string. Hashes that are
+ * not valid base64 are used as they are.
+ */
+QByteArray LazyRule::hashKey(const QString& hash)
+{
+  const QByteArray encoded = hash.toLatin1();
+  const auto decoded = QByteArray::fromBase64Encoding(encoded, QByteArray::AbortOnBase64DecodingErrors);
+  return decoded ? *decoded : encoded;
+}
+
 QDebug& operator<<(QDebug& out, const Rule& rule)
 {
   QDebugStateSaver saver(out);
@@ -113,6 +451,13 @@ QDebug& operator<<(QDebug& out, const Rule& rule)
   return out;
 }
 
+QDebug& operator<<(QDebug& out, const LazyRule& rule)
+{
+  QDebugStateSaver saver(out);
+  out.noquote() << rule.getRuleString();
+  return out;
+}
+
 QDebug& operator<<(QDebug& out, const Rule::Target& target)
 {
   QDebugStateSaver saver(out);
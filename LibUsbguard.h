@@ -18,9 +18,13 @@
 //
 #pragma once
 
+#include <QByteArray>
+#include <QMap>
 #include <QMetaType>
 #include <QString>
+#include <QStringList>
 
+#include <optional>
 #include <stdint.h>
 
 #include <Rule.hpp>
@@ -72,6 +76,63 @@ private:
   friend QDebug& operator<<(QDebug& out, const Rule& rule);
 };
 
+/*
+ * A device rule as sent by usbguard. The attributes needed to show a device
+ * are taken from the attributes sent along with the rule, or extracted from
+ * the rule text only when first requested, with a quick scan; the full
+ * libusbguard parser runs only when rule() is called, e.g. for the
+ * descriptions of the interface types.
+ */
+class LazyRule
+{
+public:
+  LazyRule();
+  explicit LazyRule(const QString& rule_string);
+  LazyRule(const QString& rule_string, Rule::Target target, const QMap<QString, QString>& attributes);
+  ~LazyRule();
+
+  QString getDeviceID() const;
+  QString getHash() const;
+  QByteArray getHashKey() const;
+  QStringList getInterfaces() const;
+  QString getName() const;
+  QString getParentHash() const;
+  QByteArray getParentHashKey() const;
+  uint32_t getRuleID() const;
+  QString getSerial() const;
+  Rule::Target getTarget() const;
+  QString getViaPort() const;
+  const QString& getRuleString() const;
+
+  void setRuleID(uint32_t rule_id);
+
+  const Rule& rule() const;
+
+  static QByteArray hashKey(const QString& hash);
+
+private:
+  struct Attributes
+  {
+    Rule::Target target = Rule::Target::Invalid;
+    QString device_id;
+    QString hash;
+    QByteArray hash_key;
+    QStringList interfaces;
+    QString name;
+    QString parent_hash;
+    QByteArray parent_hash_key;
+    QString serial;
+    QString via_port;
+  };
+
+  const Attributes& attributes() const;
+
+  QString _rule_string;
+  uint32_t _rule_id;
+  mutable std::optional<Attributes> _attributes;
+  mutable std::optional<Rule> _rule;
+};
+
 class DeviceManager
 {
 public:
@@ -85,6 +146,7 @@ public:
 };
 
 QDebug& operator<<(QDebug& out, const Rule& rule);
+QDebug& operator<<(QDebug& out, const LazyRule& rule);
 QDebug& operator<<(QDebug& out, const Rule::Target& target);
 
 Q_DECLARE_METATYPE(Rule::Target);
@@ -19,4 +19,258 @@
 
 #include "Log.h"
 
+#include <QDebug>
+#include <QSemaphore>
+#include <QThread>
+
+#include <atomic>
+#include <mutex>
+
 Q_LOGGING_CATEGORY(LOG, "usbguard.applet-qt", QtWarningMsg)
+
+namespace
+{
+  struct LogRecord
+  {
+    const char* function = nullptr;
+    int count = 0;
+    LogField fields[StructuredLog::MaxFields];
+  };
+
+  /*
+   * Bounded multi-producer, single-consumer queue: a producer claims a slot
+   * by advancing the enqueue position, and publishes it through the
+   * sequence number of the slot, so neither side ever takes a lock. When
+   * the queue is full the record is dropped and counted.
+   */
+  class LogQueue
+  {
+  public:
+    static const quint64 Capacity = 4096;
+
+    LogQueue()
+    {
+      for (quint64 i = 0; i < Capacity; ++i) {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    bool push(LogRecord&& record)
+    {
+      quint64 position = _enqueue_position.load(std::memory_order_relaxed);
+      Slot* slot;
+
+      for (;;) {
+        slot = &_slots[position % Capacity];
+        const quint64 sequence = slot->sequence.load(std::memory_order_acquire);
+        const qint64 difference = qint64(sequence) - qint64(position);
+
+        if (difference == 0) {
+          if (_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        }
+        else if (difference < 0) {
+          _dropped.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        else {
+          position = _enqueue_position.load(std::memory_order_relaxed);
+        }
+      }
+
+      slot->record = std::move(record);
+      slot->sequence.store(position + 1, std::memory_order_release);
+      return true;
+    }
+
+    /* Only called by the writer thread. */
+    bool isEmpty() const
+    {
+      const Slot& slot = _slots[_dequeue_position % Capacity];
+      return slot.sequence.load(std::memory_order_acquire) != _dequeue_position + 1;
+    }
+
+    /* Only called by the writer thread. */
+    bool pop(LogRecord& record)
+    {
+      Slot* slot = &_slots[_dequeue_position % Capacity];
+
+      if (slot->sequence.load(std::memory_order_acquire) != _dequeue_position + 1) {
+        return false;
+      }
+
+      record = std::move(slot->record);
+      slot->record = LogRecord();
+      slot->sequence.store(_dequeue_position + Capacity, std::memory_order_release);
+      ++_dequeue_position;
+      return true;
+    }
+
+    quint64 takeDropped()
+    {
+      return _dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+  private:
+    struct Slot
+    {
+      std::atomic<quint64> sequence;
+      LogRecord record;
+    };
+
+    Slot _slots[Capacity];
+    std::atomic<quint64> _enqueue_position{ 0 };
+    quint64 _dequeue_position = 0;
+    std::atomic<quint64> _dropped{ 0 };
+  };
+
+  /*
+   * The writer sleeps while the queue is empty: before sleeping it raises
+   * _waiting and checks the queue once more, and the first producer that
+   * sees the flag wakes it up; the fences make sure that either the writer
+   * sees the record, or the producer sees the flag.
+   */
+  class LogWriter : public QThread
+  {
+  public:
+    void post(LogRecord&& record)
+    {
+      if (!_queue.push(std::move(record))) {
+        return;
+      }
+
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      if (_waiting.load(std::memory_order_relaxed) &&
+        _waiting.exchange(false, std::memory_order_relaxed)) {
+        _wake.release();
+      }
+    }
+
+    void stop()
+    {
+      requestInterruption();
+      _wake.release();
+      wait();
+    }
+
+  protected:
+    void run() override
+    {
+      while (!isInterruptionRequested()) {
+        if (drain()) {
+          continue;
+        }
+
+        _waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (_queue.isEmpty() && !isInterruptionRequested()) {
+          _wake.acquire();
+        }
+
+        _waiting.store(false, std::memory_order_relaxed);
+      }
+
+      drain();
+    }
+
+  private:
+    bool drain()
+    {
+      LogRecord record;
+      bool drained = false;
+
+      while (_queue.pop(record)) {
+        write(record);
+        drained = true;
+      }
+
+      const quint64 dropped = _queue.takeDropped();
+
+      if (dropped > 0) {
+        qCDebug(LOG) << "Dropped" << dropped << "log records, the queue was full";
+      }
+
+      return drained;
+    }
+
+    static void write(const LogRecord& record)
+    {
+      /* The function goes in the context, %{function} in QT_MESSAGE_PATTERN. */
+      QDebug debug = QMessageLogger(nullptr, 0, record.function, LOG().categoryName()).debug();
+      debug.nospace();
+
+      for (int i = 0; i < record.count; ++i) {
+        const LogField& field = record.fields[i];
+        debug << (i > 0 ? " " : "") << field.key() << "=";
+
+        switch (field.type()) {
+        case LogField::Type::Signed:
+          debug << field.signedValue();
+          break;
+
+        case LogField::Type::Unsigned:
+          debug << field.unsignedValue();
+          break;
+
+        case LogField::Type::Pointer:
+          debug << field.pointerValue();
+          break;
+
+        case LogField::Type::String:
+          debug << field.stringValue();
+          break;
+
+        case LogField::Type::None:
+        default:
+          break;
+        }
+      }
+    }
+
+    LogQueue _queue;
+    std::atomic<bool> _waiting{ false };
+    QSemaphore _wake;
+  };
+
+  LogWriter* writer = nullptr;
+  std::once_flag writer_started;
+}
+
+void StructuredLog::post(const char* function, std::initializer_list<LogField> fields)
+{
+  std::call_once(writer_started, []() {
+      writer = new LogWriter;
+      writer->start(QThread::LowPriority);
+    });
+
+  if (writer == nullptr) {
+    return;
+  }
+
+  LogRecord record;
+  record.function = function;
+
+  for (const LogField& field : fields) {
+    if (record.count == MaxFields) {
+      break;
+    }
+
+    record.fields[record.count++] = field;
+  }
+
+  writer->post(std::move(record));
+}
+
+void StructuredLog::shutdown()
+{
+  if (writer == nullptr) {
+    return;
+  }
+
+  writer->stop();
+  delete writer;
+  writer = nullptr;
+}
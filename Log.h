@@ -19,5 +19,98 @@
 #pragma once
 
 #include <QLoggingCategory>
+#include <QString>
+
+#include <initializer_list>
+#include <type_traits>
 
 Q_DECLARE_LOGGING_CATEGORY(LOG)
+
+/*
+ * Structured debug logging for the hot paths. LOG_FIELDS stores the
+ * function name and a few key/value fields in a binary record, and a
+ * background thread formats the records through the LOG category later:
+ * numbers are kept as they are, strings as shallow QString copies. When
+ * the debug output of LOG is disabled, nothing at all is done.
+ *
+ *   LOG_FIELDS({ "id", id }, { "permanent", permanent });
+ */
+class LogField
+{
+public:
+  enum class Type : quint8 {
+    None,
+    Signed,
+    Unsigned,
+    Pointer,
+    String,
+  };
+
+  LogField() = default;
+
+  template<typename T, std::enable_if_t<std::is_integral_v<T> && std::is_signed_v<T>, int> = 0>
+  LogField(const char* key, T value) :
+    _key(key), _type(Type::Signed), _signed(value)
+  {
+  }
+
+  template<typename T, std::enable_if_t<std::is_integral_v<T> && std::is_unsigned_v<T>, int> = 0>
+  LogField(const char* key, T value) :
+    _key(key), _type(Type::Unsigned), _unsigned(value)
+  {
+  }
+
+  template<typename T, std::enable_if_t<std::is_enum_v<T>, int> = 0>
+  LogField(const char* key, T value) :
+    _key(key), _type(Type::Signed), _signed(qint64(value))
+  {
+  }
+
+  LogField(const char* key, const void* value) :
+    _key(key), _type(Type::Pointer), _pointer(value)
+  {
+  }
+
+  LogField(const char* key, const QString& value) :
+    _key(key), _type(Type::String), _string(value)
+  {
+  }
+
+  const char* key() const { return _key; }
+  Type type() const { return _type; }
+  qint64 signedValue() const { return _signed; }
+  quint64 unsignedValue() const { return _unsigned; }
+  const void* pointerValue() const { return _pointer; }
+  const QString& stringValue() const { return _string; }
+
+private:
+  const char* _key = nullptr;
+  Type _type = Type::None;
+
+  union {
+    qint64 _signed = 0;
+    quint64 _unsigned;
+    const void* _pointer;
+  };
+
+  QString _string;
+};
+
+namespace StructuredLog
+{
+  /* Fields past this number are dropped. */
+  const int MaxFields = 4;
+
+  /* function must have static storage, e.g. Q_FUNC_INFO. */
+  void post(const char* function, std::initializer_list<LogField> fields);
+
+  /* Formats the pending records, and stops the background thread. */
+  void shutdown();
+}
+
+#define LOG_FIELDS(...) \
+  do { \
+    if (LOG().isDebugEnabled()) { \
+      StructuredLog::post(Q_FUNC_INFO, { __VA_ARGS__ }); \
+    } \
+  } while (false)
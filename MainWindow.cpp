@@ -19,18 +19,28 @@
 #include "MainWindow.h"
 #include <ui_MainWindow.h>
 #include "DeviceDialog.h"
+#include "DeviceListDialog.h"
 #include "DBusBridge.h"
 #include "Log.h"
+#include "StartupTrace.h"
 
+#include <QDBusPendingCallWatcher>
 #include <QString>
 #include <QSystemTrayIcon>
 #include <QTimer>
 #include <QMessageBox>
 #include <QApplication>
 #include <QResource>
+#include <QScrollBar>
 #include <QMenu>
 #include <QAction>
 #include <QDateTime>
+#include <QFontDatabase>
+#include <QJsonDocument>
+#include <QPlainTextEdit>
+#include <QHash>
+#include <QSharedPointer>
+#include <QStringList>
 #include <QTime>
 #include <QSpinBox>
 #include <QComboBox>
@@ -39,18 +49,32 @@
 #include <QShortcut>
 #include <QWindowStateChangeEvent>
 
-MainWindow::MainWindow(QWidget* parent) :
+MainWindow::MainWindow(const QDBusConnection& bus, QWidget* parent) :
   QMainWindow(parent),
   ui(new Ui::MainWindow),
   _settings(QLatin1String("USBGuard"), QLatin1String("usbguard-applet-qt")),
   _device_model(this),
-  _bridge(this)
+  _message_model(MessageModel::DefaultCapacity, this),
+  _journal(this),
+  _journal_model(&_journal, this),
+  _bridge(bus, this)
 {
+  StartupTrace::mark("MainWindow members");
   ui->setupUi(this);
+  StartupTrace::mark("setupUi");
   ui->device_view->setModel(&_device_model);
+  ui->messages_view->setModel(&_message_model);
+  _journal.open();
+  _journal_model.reload();
+  ui->history_view->setModel(&_journal_model);
+  QObject::connect(&_journal_model, &EventJournalModel::rowsInserted,
+    this, &MainWindow::followJournal);
   ui->device_view->setItemDelegateForColumn(2, &_target_delegate);
   ui->device_view->resizeColumnToContents(1);
   ui->device_view->setItemsExpandable(false);
+  QObject::connect(&_device_model, &DeviceModel::rowsInserted,
+    this, &MainWindow::expandInsertedDevices);
+  setupDiagnostics();
   QObject::connect(ui->device_view->selectionModel(), &QItemSelectionModel::currentRowChanged,
     this, &MainWindow::editDeviceListRow);
   QObject::connect(ui->device_view, &QTreeView::clicked,
@@ -62,32 +86,42 @@ MainWindow::MainWindow(QWidget* parent) :
   setWindowTitle(tr("USBGuard"));
   setWindowIcon(QIcon(QLatin1String(":/usbguard-icon.svg")));
   setWindowState(Qt::WindowMinimized);
+  StartupTrace::mark("views and models");
   setupSystemTray();
+  StartupTrace::mark("setupSystemTray");
   qRegisterMetaType<DeviceManager::EventType>("DeviceManager::EventType");
   qRegisterMetaType<Rule::Target>("Rule::Target");
-  QObject::connect(&_bridge, &DBusBridge::devicePresenceChanged,
-    this, &MainWindow::handleDevicePresenceChange);
-  QObject::connect(&_bridge, &DBusBridge::devicePolicyChanged,
-    this, &MainWindow::handleDevicePolicyChange);
+  QObject::connect(&_bridge, &DBusBridge::devicesChanged,
+    this, &MainWindow::handleDeviceEvents);
   QObject::connect(&_bridge, &DBusBridge::serviceAvailable,
     this, &MainWindow::handleDBusConnect);
   QObject::connect(&_bridge, &DBusBridge::serviceUnavailable,
     this, &MainWindow::handleDBusDisconnect);
+  QObject::connect(&_bridge, &DBusBridge::connectionFailed,
+    this, &MainWindow::dbusConnectionFailed);
   /*
    * loadSettings has to be called before setupSettingsWatcher! Otherwise it
    * will trigger the slots connected by the setupSettingsWatcher method.
    */
   loadSettings();
   setupSettingsWatcher();
+  StartupTrace::mark("loadSettings");
   ui->statusBar->showMessage(tr("Inactive. No D-Bus connection."));
   new QShortcut(QKeySequence(Qt::Key_Escape, Qt::Key_Escape), this, this, &MainWindow::showMinimized);
 
-  QTimer::singleShot(1000, this, &MainWindow::dbusTryConnect);
+  /*
+   * The connection is asynchronous, and the bridge waits for the service
+   * to be ready: start right away rather than after a fixed delay.
+   */
+  dbusTryConnect();
+  StartupTrace::mark("dbusTryConnect");
 }
 
 void MainWindow::setupSystemTray()
 {
-  systray = new QSystemTrayIcon(QIcon(QLatin1String(":/usbguard-icon-inactive.svg")), this);
+  loadTrayIcons();
+  _tray_state = TrayState::Inactive;
+  systray = new QSystemTrayIcon(_tray_icons[int(_tray_state)], this);
   systray->setToolTip(tr("USBGuard"));
   auto menu = new QMenu();
   auto quit_action = new QAction(tr("Quit"), systray);
@@ -101,18 +135,134 @@ void MainWindow::setupSystemTray()
   systray->show();
 }
 
+void MainWindow::loadTrayIcons()
+{
+  /*
+   * Render the SVG icons once, at the sizes a tray usually asks for:
+   * flashing switches between them several times per second.
+   */
+  static const char* const files[TrayStateCount] = {
+    ":/usbguard-icon-inactive.svg",
+    ":/usbguard-icon.svg",
+    ":/usbguard-icon-warning.svg",
+  };
+  static const int sizes[] = { 16, 22, 24, 32, 48, 64 };
+  const qreal ratio = qApp->devicePixelRatio();
+
+  for (int i = 0; i < TrayStateCount; ++i) {
+    const QIcon svg_icon(QLatin1String(files[i]));
+    QIcon icon;
+
+    for (int size : sizes) {
+      icon.addPixmap(svg_icon.pixmap(QSize(size, size), ratio));
+    }
+
+    _tray_icons[i] = icon;
+  }
+}
+
+void MainWindow::setTrayState(TrayState state)
+{
+  if (state == _tray_state) {
+    return;
+  }
+
+  _tray_state = state;
+  systray->setIcon(_tray_icons[int(state)]);
+}
+
+MainWindow::TrayState MainWindow::idleTrayState() const
+{
+  return _bridge.isConnected() ? TrayState::Active : TrayState::Inactive;
+}
+
+void MainWindow::setupDiagnostics()
+{
+  /*
+   * The relayout latency is the time between a change of the device model
+   * and the next paint of the device view; only measured while the view is
+   * shown, as a hidden view does not paint until the window is opened.
+   */
+  const auto start_relayout = [this]() {
+    if (!_relayout_timer.isValid() && ui->device_view->viewport()->isVisible()) {
+      _relayout_timer.start();
+    }
+  };
+  QObject::connect(&_device_model, &DeviceModel::rowsInserted, this, start_relayout);
+  QObject::connect(&_device_model, &DeviceModel::rowsRemoved, this, start_relayout);
+  QObject::connect(&_device_model, &DeviceModel::dataChanged, this, start_relayout);
+  ui->device_view->viewport()->installEventFilter(this);
+
+  _diagnostics.installSignalHandler();
+  _diagnostics_timer.setInterval(1000);
+  QObject::connect(&_diagnostics_timer, &QTimer::timeout,
+    this, &MainWindow::refreshDiagnostics);
+  new QShortcut(QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_D), this, this, &MainWindow::toggleDiagnosticsTab);
+}
+
+void MainWindow::toggleDiagnosticsTab()
+{
+  if (!_diagnostics_text) {
+    _diagnostics_text = new QPlainTextEdit(this);
+    _diagnostics_text->setReadOnly(true);
+    _diagnostics_text->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  }
+
+  const int index = ui->tabWidget->indexOf(_diagnostics_text);
+
+  if (index < 0) {
+    ui->tabWidget->addTab(_diagnostics_text, tr("Diagnostics"));
+    ui->tabWidget->setCurrentWidget(_diagnostics_text);
+    refreshDiagnostics();
+    _diagnostics_timer.start();
+  }
+  else {
+    _diagnostics_timer.stop();
+    ui->tabWidget->removeTab(index);
+  }
+}
+
+void MainWindow::refreshDiagnostics()
+{
+  if (!isVisible()) {
+    return;
+  }
+
+  _diagnostics_text->setPlainText(QString::fromUtf8(QJsonDocument(Diagnostics::toJson()).toJson()));
+}
+
+bool MainWindow::eventFilter(QObject* object, QEvent* event)
+{
+  if (_relayout_timer.isValid() && object == ui->device_view->viewport()) {
+    if (event->type() == QEvent::Paint) {
+      Diagnostics::record(Diagnostics::Stage::ViewRelayout, _relayout_timer.nsecsElapsed());
+      _relayout_timer.invalidate();
+    }
+    else if (event->type() == QEvent::Hide) {
+      _relayout_timer.invalidate();
+    }
+  }
+
+  return QMainWindow::eventFilter(object, event);
+}
+
 void MainWindow::setupSettingsWatcher()
 {
+  _settings_timer.setSingleShot(true);
+  _settings_timer.setInterval(500);
+  QObject::connect(&_settings_timer, &QTimer::timeout,
+    this, &MainWindow::saveSettings);
+
   for (QCheckBox* checkbox : ui->settings_tab->findChildren<QCheckBox*>()) {
-    QObject::connect(checkbox, &QCheckBox::toggled, this, &MainWindow::saveSettings);
+    QObject::connect(checkbox, &QCheckBox::toggled, this, &MainWindow::scheduleSaveSettings);
   }
 
   for (QComboBox* combobox : ui->settings_tab->findChildren<QComboBox*>()) {
-    QObject::connect(combobox, &QComboBox::currentIndexChanged, this, &MainWindow::saveSettings);
+    QObject::connect(combobox, &QComboBox::currentIndexChanged, this, &MainWindow::scheduleSaveSettings);
   }
 
   for (QSpinBox* spinbox : ui->settings_tab->findChildren<QSpinBox*>()) {
-    QObject::connect(spinbox, &QSpinBox::valueChanged, this, &MainWindow::saveSettings);
+    QObject::connect(spinbox, &QSpinBox::valueChanged, this, &MainWindow::scheduleSaveSettings);
   }
 }
 
@@ -138,36 +288,50 @@ void MainWindow::switchVisibilityState(QSystemTrayIcon::ActivationReason reason)
 
 MainWindow::~MainWindow()
 {
+  if (_settings_timer.isActive()) {
+    saveSettings();
+  }
+
   delete ui;
 }
 
-void MainWindow::showDeviceDialog(quint32 id, const Rule& device_rule)
+Rule::Target MainWindow::defaultDecision() const
 {
-  auto dialog = new DeviceDialog(id);
-  dialog->setRejectVisible(ui->show_reject_button_checkbox->isChecked());
-  dialog->setDefaultDecisionTimeout(ui->decision_timeout->value());
-  dialog->setMaskSerialNumber(ui->mask_serial_checkbox->isChecked());
-  dialog->setDecisionIsPermanent(ui->decision_permanent_checkbox->isChecked());
-  Rule::Target default_target = Rule::Target::Block;
-
   switch (ui->default_decision_combobox->currentIndex()) {
   case 0:
-    default_target = Rule::Target::Allow;
-    break;
+    return Rule::Target::Allow;
 
   case 1:
-    default_target = Rule::Target::Block;
-    break;
+    return Rule::Target::Block;
 
   case 2:
-    default_target = Rule::Target::Reject;
-    break;
+    return Rule::Target::Reject;
 
   default:
-    default_target = Rule::Target::Block;
+    return Rule::Target::Block;
+  }
+}
+
+void MainWindow::showDeviceDialogs()
+{
+  if (_pending_decisions.count() == 1) {
+    showDeviceDialog(_pending_decisions.first().first, _pending_decisions.first().second.rule());
+  }
+  else if (_pending_decisions.count() > 1) {
+    showDeviceListDialog(_pending_decisions);
   }
 
-  dialog->setDefaultDecision(default_target);
+  _pending_decisions.clear();
+}
+
+void MainWindow::showDeviceDialog(quint32 id, const Rule& device_rule)
+{
+  auto dialog = new DeviceDialog(id);
+  dialog->setRejectVisible(ui->show_reject_button_checkbox->isChecked());
+  dialog->setDefaultDecisionTimeout(ui->decision_timeout->value());
+  dialog->setMaskSerialNumber(ui->mask_serial_checkbox->isChecked());
+  dialog->setDecisionIsPermanent(ui->decision_permanent_checkbox->isChecked());
+  dialog->setDefaultDecision(defaultDecision());
   dialog->setName(device_rule.getName());
   dialog->setSerial(device_rule.getSerial());
   dialog->setDeviceID(QString::fromStdString(device_rule.getDeviceID().getVendorID()),
@@ -186,27 +350,158 @@ void MainWindow::showDeviceDialog(quint32 id, const Rule& device_rule)
   dialog->activateWindow();
 }
 
+void MainWindow::showDeviceListDialog(const QList<QPair<quint32, LazyRule>>& devices)
+{
+  auto dialog = new DeviceListDialog();
+  dialog->setRejectVisible(ui->show_reject_button_checkbox->isChecked());
+  dialog->setDefaultDecisionTimeout(ui->decision_timeout->value());
+  dialog->setMaskSerialNumber(ui->mask_serial_checkbox->isChecked());
+  dialog->setDecisionIsPermanent(ui->decision_permanent_checkbox->isChecked());
+  dialog->setDefaultDecision(defaultDecision());
+
+  for (const auto& device : devices) {
+    const QString parent_name = _device_model.getDeviceName(device.second.getParentHashKey());
+    dialog->addDevice(device.first, device.second, parent_name);
+  }
+
+  dialog->layoutDevices();
+  dialog->setModal(false);
+  dialog->setRandomizePosition(ui->randomize_position_checkbox->isChecked());
+  QObject::connect(dialog, &DeviceListDialog::decided,
+    this, &MainWindow::applyDevicePolicies);
+  dialog->show();
+  dialog->raise();
+  dialog->activateWindow();
+}
+
 void MainWindow::showMessage(const QString& message, bool alert, bool statusbar)
 {
-  const QString mtemplate(QLatin1String(alert ? "[%1] <b>%2</b>" : "[%1] %2"));
+  const QString mtemplate(QLatin1String("[%1] %2"));
   const QString datetime = QDateTime::currentDateTime().toString();
   const QString mmessage = QString(mtemplate).arg(datetime).arg(message);
-  ui->messages_text->append(mmessage);
+
+  if (_batch_messages) {
+    _batched_messages.append(MessageModel::Message{ mmessage, alert });
+  }
+  else {
+    appendMessages(QList<MessageModel::Message>() << MessageModel::Message{ mmessage, alert });
+  }
 
   if (statusbar) {
-    const QString stemplate(QLatin1String("[%1] %2"));
-    const QString smessage = QString(stemplate).arg(datetime).arg(message);
-    ui->statusBar->showMessage(smessage);
+    ui->statusBar->showMessage(mmessage);
+  }
+}
+
+void MainWindow::followJournal()
+{
+  QScrollBar* scrollbar = ui->history_view->verticalScrollBar();
+
+  if (scrollbar->value() == scrollbar->maximum()) {
+    ui->history_view->scrollToBottom();
+  }
+}
+
+void MainWindow::appendMessages(const QList<MessageModel::Message>& messages)
+{
+  // Keep following the new messages, unless scrolled back.
+  QScrollBar* scrollbar = ui->messages_view->verticalScrollBar();
+  const bool at_bottom = scrollbar->value() == scrollbar->maximum();
+  _message_model.appendMessages(messages);
+
+  if (at_bottom) {
+    ui->messages_view->scrollToBottom();
+  }
+}
+
+void MainWindow::handleDeviceEvents(const DeviceEvents& events)
+{
+  LOG_FIELDS({ "presence", events.presence.count() }, { "policy", events.policy.count() });
+
+  /*
+   * All the presence events go first, so the policy events find the devices
+   * in the model; the log and the tray are updated once for the whole batch.
+   */
+  _batch_messages = true;
+
+  if (!events.presence.isEmpty()) {
+    ++_presence_serial;
+  }
+
+  for (const auto& event : events.presence) {
+    handleDevicePresenceChange(event.id, event.event, event.target, event.device_rule);
+  }
+
+  for (const auto& event : events.policy) {
+    handleDevicePolicyChange(event.id, event.target_old, event.target_new, event.device_rule, event.rule_id);
+  }
+
+  _batch_messages = false;
+  flushBatchedMessages();
+  showDeviceDialogs();
+}
+
+void MainWindow::flushBatchedMessages()
+{
+  if (!_batched_messages.isEmpty()) {
+    appendMessages(_batched_messages);
+    _batched_messages.clear();
+  }
+
+  /*
+   * Events of a single device, e.g. inserted and then blocked, are shown as
+   * the last of them, with the device details; only several devices are
+   * summarized.
+   */
+  bool single_device = true;
+
+  for (const auto& notification : std::as_const(_batched_notifications)) {
+    if (notification.device_id != _batched_notifications.first().device_id) {
+      single_device = false;
+      break;
+    }
+  }
+
+  if (_batched_notifications.isEmpty()) {
+    /* NOOP */
+  }
+  else if (single_device) {
+    const Notification& notification = _batched_notifications.last();
+    systray->showMessage(notification.title, notification.message, notification.icon);
+  }
+  else {
+    QSystemTrayIcon::MessageIcon icon = QSystemTrayIcon::Information;
+    QStringList titles;
+    QHash<QString, int> title_counts;
+
+    for (const auto& notification : _batched_notifications) {
+      if (notification.icon == QSystemTrayIcon::Warning) {
+        icon = QSystemTrayIcon::Warning;
+      }
+
+      if (title_counts[notification.title]++ == 0) {
+        titles.append(notification.title);
+      }
+    }
+
+    QStringList lines;
+
+    for (const auto& title : titles) {
+      lines.append(QString::fromLatin1("%1: %2").arg(title).arg(title_counts.value(title)));
+    }
+
+    systray->showMessage(tr("%n USB device event(s)", nullptr, _batched_notifications.count()),
+      lines.join(QLatin1Char('\n')), icon);
   }
+
+  _batched_notifications.clear();
 }
 
 void MainWindow::handleDevicePresenceChange(uint id,
   DeviceManager::EventType event,
   Rule::Target target,
-  const QString& device_rule_string)
+  const LazyRule& device_rule)
 {
   (void)target;
-  auto device_rule = Rule::fromString(device_rule_string);
 
   switch (event) {
   case DeviceManager::EventType::Insert:
@@ -230,25 +525,24 @@ void MainWindow::handleDevicePresenceChange(uint id,
 void MainWindow::handleDevicePolicyChange(uint id,
   Rule::Target target_old,
   Rule::Target target_new,
-  const QString& device_rule_string,
+  const LazyRule& device_rule,
   uint rule_id)
 {
   (void)target_old;
-  auto device_rule = Rule::fromString(device_rule_string);
   _device_model.updateDeviceTarget(id, target_new);
-  ui->device_view->expandAll();
   notifyDevicePolicyChanged(device_rule, rule_id);
 
   if (target_new == Rule::Target::Block &&
     rule_id == Rule::ImplicitID) {
-    showDeviceDialog(id, device_rule);
+    _pending_decisions.append(qMakePair(id, device_rule));
   }
 }
 
 void MainWindow::notifyDevicePresenceChanged(DeviceManager::EventType event,
-  const Rule& device_rule)
+  const LazyRule& device_rule)
 {
   QString title;
+  EventJournal::Event journal_event;
   bool show_notification = true;
   QSystemTrayIcon::MessageIcon notification_icon = \
     QSystemTrayIcon::Information;
@@ -256,20 +550,24 @@ void MainWindow::notifyDevicePresenceChanged(DeviceManager::EventType event,
   switch (event) {
   case DeviceManager::EventType::Insert:
     title = tr("USB Device Inserted");
+    journal_event = EventJournal::Event::Inserted;
     show_notification = ui->notify_inserted->isChecked();
     break;
 
   case DeviceManager::EventType::Update:
     title = tr("USB Device Updated");
+    journal_event = EventJournal::Event::Updated;
     break;
 
   case DeviceManager::EventType::Remove:
     title = tr("USB Device Removed");
+    journal_event = EventJournal::Event::Removed;
     show_notification = ui->notify_removed->isChecked();
     break;
 
   case DeviceManager::EventType::Present:
     title = tr("USB Device Present");
+    journal_event = EventJournal::Event::Present;
     show_notification = ui->notify_present->isChecked();
     break;
 
@@ -278,13 +576,14 @@ void MainWindow::notifyDevicePresenceChanged(DeviceManager::EventType event,
     return;
   }
 
-  notify(title, notification_icon, device_rule, show_notification);
+  notify(title, notification_icon, device_rule, show_notification, journal_event);
 }
 
-void MainWindow::notifyDevicePolicyChanged(const Rule& device_rule, quint32 rule_id)
+void MainWindow::notifyDevicePolicyChanged(const LazyRule& device_rule, quint32 rule_id)
 {
   (void)rule_id;
   QString title;
+  EventJournal::Event journal_event;
   bool show_notification = true;
   QSystemTrayIcon::MessageIcon notification_icon = \
     QSystemTrayIcon::Information;
@@ -292,17 +591,20 @@ void MainWindow::notifyDevicePolicyChanged(const Rule& device_rule, quint32 rule
   switch (device_rule.getTarget()) {
   case Rule::Target::Allow:
     title = tr("USB Device Allowed");
+    journal_event = EventJournal::Event::Allowed;
     show_notification = ui->notify_allowed->isChecked();
     break;
 
   case Rule::Target::Block:
     title = tr("USB Device Blocked");
+    journal_event = EventJournal::Event::Blocked;
     show_notification = ui->notify_blocked->isChecked();
     notification_icon = QSystemTrayIcon::Warning;
     break;
 
   case Rule::Target::Reject:
     title = tr("USB Device Rejected");
+    journal_event = EventJournal::Event::Rejected;
     show_notification = ui->notify_rejected->isChecked();
     notification_icon = QSystemTrayIcon::Warning;
 
@@ -322,13 +624,16 @@ void MainWindow::notifyDevicePolicyChanged(const Rule& device_rule, quint32 rule
     return;
   }
 
-  notify(title, notification_icon, device_rule, show_notification);
+  notify(title, notification_icon, device_rule, show_notification, journal_event);
 }
 
-void MainWindow::notify(const QString& title, QSystemTrayIcon::MessageIcon icon, const Rule& device_rule,
-  bool show_notification)
+void MainWindow::notify(const QString& title, QSystemTrayIcon::MessageIcon icon, const LazyRule& device_rule,
+  bool show_notification, EventJournal::Event journal_event)
 {
-  const QString usb_id = QString::fromStdString(device_rule.getDeviceID().toString());
+  Diagnostics::Timer timer(Diagnostics::Stage::Notification);
+  _journal.append(journal_event, device_rule);
+
+  const QString usb_id = device_rule.getDeviceID();
   const QString name = device_rule.getName();
   const QString port = device_rule.getViaPort();
   const QString message_body = QString::fromLatin1("%1: USB ID=%2; Name=%3; Port=%4")
@@ -341,13 +646,19 @@ void MainWindow::notify(const QString& title, QSystemTrayIcon::MessageIcon icon,
         "Name: %2\n"
         "Port: %3\n")
       .arg(usb_id).arg(name).arg(port);
-    showNotification(icon, title, notification_body);
+    showNotification(icon, title, notification_body, device_rule.getRuleID());
   }
 }
 
-void MainWindow::showNotification(QSystemTrayIcon::MessageIcon icon, const QString& title, const QString& message)
+void MainWindow::showNotification(QSystemTrayIcon::MessageIcon icon, const QString& title, const QString& message,
+  quint32 device_id)
 {
-  systray->showMessage(title, message, icon);
+  if (_batch_messages) {
+    _batched_notifications.append(Notification{ icon, title, message, device_id });
+  }
+  else {
+    systray->showMessage(title, message, icon);
+  }
 }
 
 void MainWindow::notifyDBusConnected()
@@ -383,32 +694,18 @@ void MainWindow::stopFlashing()
 {
   _flash_state = false;
   _flash_timer.stop();
-
-  if (_bridge.isConnected()) {
-    systray->setIcon(QIcon(QLatin1String(":/usbguard-icon.svg")));
-  }
-  else {
-    systray->setIcon(QIcon(QLatin1String(":/usbguard-icon-inactive.svg")));
-  }
+  setTrayState(idleTrayState());
 }
 
 void MainWindow::flashStep()
 {
   if (_flash_state) {
-    systray->setIcon(QIcon(QLatin1String(":/usbguard-icon-warning.svg")));
-    systray->show();
+    setTrayState(TrayState::Warning);
     _flash_timer.setInterval(250);
     _flash_state = false;
   }
   else {
-    if (_bridge.isConnected()) {
-      systray->setIcon(QIcon(QLatin1String(":/usbguard-icon.svg")));
-    }
-    else {
-      systray->setIcon(QIcon(QLatin1String(":/usbguard-icon-inactive.svg")));
-    }
-
-    systray->show();
+    setTrayState(idleTrayState());
     _flash_timer.setInterval(500);
     _flash_state = true;
   }
@@ -417,63 +714,56 @@ void MainWindow::flashStep()
 void MainWindow::dbusTryConnect()
 {
   qCDebug(LOG);
+  _bridge.tryConnect();
+}
 
-  QDBusReply<bool> reply = _bridge.tryConnect();
-  if (!reply.isValid()) {
-    showMessage(QString::fromLatin1("Connection failed: %1")
-      .arg(reply.error().message()),
-      /*alert=*/true);
-  }
-  else if (!reply.value()) {
-    showMessage(QLatin1String("Connection failed: D-Bus service not available"),
-      /*alert=*/true);
-  }
+void MainWindow::dbusConnectionFailed(const QString& message)
+{
+  StartupTrace::finish("connection failed", /*ok=*/false);
+  showMessage(QString::fromLatin1("Connection failed: %1").arg(message),
+    /*alert=*/true);
 }
 
 void MainWindow::allowDevice(quint32 id, bool permanent)
 {
-  qCDebug(LOG) << "id=" << id << " permanent=" << permanent;
-
-  QDBusPendingReply<uint> reply = _bridge.applyDevicePolicy(id, Rule::Target::Allow, permanent);
-  if (!reply.isValid()) {
-    showMessage(QString::fromLatin1("D-Bus call failed: %1: %2")
-      .arg(QLatin1String("allowDevice"))
-      .arg(reply.error().message()),
-      /*alert=*/true);
-  }
+  LOG_FIELDS({ "id", id }, { "permanent", permanent });
+  applyDevicePolicy(id, Rule::Target::Allow, permanent, QLatin1String("allowDevice"));
 }
 
 void MainWindow::blockDevice(quint32 id, bool permanent)
 {
-  qCDebug(LOG) << "id=" << id << " permanent=" << permanent;
-
-  QDBusPendingReply<uint> reply = _bridge.applyDevicePolicy(id, Rule::Target::Block, permanent);
-  if (!reply.isValid()) {
-    showMessage(QString::fromLatin1("D-Bus call failed: %1: %2")
-      .arg(QLatin1String("blockDevice"))
-      .arg(reply.error().message()),
-      /*alert=*/true);
-  }
+  LOG_FIELDS({ "id", id }, { "permanent", permanent });
+  applyDevicePolicy(id, Rule::Target::Block, permanent, QLatin1String("blockDevice"));
 }
 
 void MainWindow::rejectDevice(quint32 id, bool permanent)
 {
-  qCDebug(LOG) << "id=" << id << " permanent=" << permanent;
+  LOG_FIELDS({ "id", id }, { "permanent", permanent });
+  applyDevicePolicy(id, Rule::Target::Reject, permanent, QLatin1String("rejectDevice"));
+}
 
-  QDBusPendingReply<uint> reply = _bridge.applyDevicePolicy(id, Rule::Target::Reject, permanent);
-  if (!reply.isValid()) {
-    showMessage(QString::fromLatin1("D-Bus call failed: %1: %2")
-      .arg(QLatin1String("rejectDevice"))
-      .arg(reply.error().message()),
-      /*alert=*/true);
-  }
+void MainWindow::applyDevicePolicy(quint32 id, Rule::Target target, bool permanent, const QString& call_name)
+{
+  auto watcher = new QDBusPendingCallWatcher(_bridge.applyDevicePolicy(id, target, permanent), this);
+  QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this,
+    [this, call_name](QDBusPendingCallWatcher* watcher) {
+      QDBusPendingReply<uint> reply = *watcher;
+      watcher->deleteLater();
+
+      if (!reply.isValid()) {
+        showMessage(QString::fromLatin1("D-Bus call failed: %1: %2")
+          .arg(call_name)
+          .arg(reply.error().message()),
+          /*alert=*/true);
+      }
+    });
 }
 
 void MainWindow::handleDBusConnect()
 {
   qCDebug(LOG);
   notifyDBusConnected();
-  systray->setIcon(QIcon(QLatin1String(":/usbguard-icon.svg")));
+  setTrayState(TrayState::Active);
   ui->device_view->setDisabled(false);
   loadDeviceList();
 }
@@ -482,22 +772,123 @@ void MainWindow::handleDBusDisconnect()
 {
   qCDebug(LOG);
   notifyDBusDisconnected();
-  systray->setIcon(QIcon(QLatin1String(":/usbguard-icon-inactive.svg")));
+  setTrayState(TrayState::Inactive);
   clearDeviceList();
   ui->device_view->setDisabled(true);
 }
 
-void MainWindow::handleDeviceInsert(quint32 id, const Rule& device_rule)
+void MainWindow::handleDeviceInsert(quint32 id, const LazyRule& device_rule)
 {
-  qCDebug(LOG) << "id=" << id << " device_rule=" << device_rule;
-  loadDeviceList();
+  LOG_FIELDS({ "id", id }, { "device_rule", device_rule.getRuleString() });
+  insertDevice(device_rule);
 }
 
-void MainWindow::handleDeviceRemove(quint32 id, const Rule& device_rule)
+void MainWindow::handleDeviceRemove(quint32 id, const LazyRule& device_rule)
 {
-  qCDebug(LOG) << "id=" << id << " device_rule=" << device_rule;
+  LOG_FIELDS({ "id", id }, { "device_rule", device_rule.getRuleString() });
   _device_model.removeDevice(id);
-  ui->device_view->expandAll();
+
+  /*
+   * The device may still be parked waiting for its parent, and devices may
+   * be parked waiting for it: forget them, or they would show up later.
+   */
+  for (auto it = _pending_devices.begin(); it != _pending_devices.end();) {
+    if (it.value().getRuleID() == id) {
+      it = _pending_devices.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+
+  _pending_devices.remove(device_rule.getHash());
+}
+
+void MainWindow::insertDevice(const LazyRule& device_rule)
+{
+  if (_device_model.containsDevice(device_rule.getRuleID())) {
+    return;
+  }
+
+  /*
+   * The parent device is usually already in the model, as it was inserted
+   * before its children; otherwise park the device until the daemon tells
+   * us about its parent, asking only for that device.
+   */
+  const QString parent_hash = device_rule.getParentHash();
+
+  if (parent_hash.isEmpty() || _device_model.containsDeviceHash(device_rule.getParentHashKey())) {
+    insertDeviceTree(device_rule);
+    return;
+  }
+
+  const bool query_pending = _pending_devices.contains(parent_hash);
+  _pending_devices.insert(parent_hash, device_rule);
+
+  if (!query_pending) {
+    loadParentDevice(parent_hash);
+  }
+}
+
+void MainWindow::insertDeviceTree(const LazyRule& device_rule)
+{
+  if (_device_model.containsDevice(device_rule.getRuleID())) {
+    return;
+  }
+
+  _device_model.insertDevice(device_rule);
+
+  const QString device_hash = device_rule.getHash();
+  const QList<LazyRule> children = _pending_devices.values(device_hash);
+  _pending_devices.remove(device_hash);
+
+  for (const auto& child_rule : children) {
+    insertDeviceTree(child_rule);
+  }
+}
+
+void MainWindow::loadParentDevice(const QString& parent_hash)
+{
+  LOG_FIELDS({ "parent_hash", parent_hash });
+  const QString query = QString::fromLatin1("match hash \"%1\"").arg(parent_hash);
+  auto watcher = new QDBusPendingCallWatcher(_bridge.listDevices(query), this);
+  QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this,
+    [this, parent_hash](QDBusPendingCallWatcher* watcher) {
+      QDBusPendingReply<DBusRules> reply = *watcher;
+      watcher->deleteLater();
+
+      if (!_pending_devices.contains(parent_hash)) {
+        return;
+      }
+
+      bool parent_found = false;
+
+      if (reply.isValid()) {
+        for (auto rule : reply.value()) {
+          LazyRule parent_rule(rule.second);
+          parent_rule.setRuleID(rule.first);
+
+          if (parent_rule.getHash() == parent_hash) {
+            insertDevice(parent_rule);
+            parent_found = true;
+            break;
+          }
+        }
+      }
+
+      if (!parent_found) {
+        /*
+         * There is no such device (e.g. the parent of a root hub), so the
+         * parked children go to the top level.
+         */
+        const QList<LazyRule> children = _pending_devices.values(parent_hash);
+        _pending_devices.remove(parent_hash);
+
+        for (const auto& child_rule : children) {
+          insertDeviceTree(child_rule);
+        }
+      }
+    });
 }
 
 void MainWindow::loadSettings()
@@ -533,44 +924,80 @@ void MainWindow::loadSettings()
   ui->randomize_position_checkbox->setChecked(_settings.value(QLatin1String("RandomizeWindowPosition"), true).toBool());
   ui->mask_serial_checkbox->setChecked(_settings.value(QLatin1String("MaskSerialNumber"), true).toBool());
   _settings.endGroup();
+  // Not in the settings tab: how long to collect device events before handling them.
+  _settings.beginGroup(QLatin1String("DeviceEvents"));
+  const int coalescing_interval = _settings.value(QLatin1String("CoalescingInterval"),
+    DBusBridge::DefaultCoalescingInterval).toInt();
+  _bridge.setCoalescingInterval(qBound(0, coalescing_interval, 1000));
+  _settings.endGroup();
+}
+
+void MainWindow::scheduleSaveSettings()
+{
+  /*
+   * Dragging a spinbox or clicking through the checkboxes changes several
+   * values in a row: write them once things have settled down.
+   */
+  _settings_timer.start();
 }
 
 void MainWindow::saveSettings()
 {
   qCDebug(LOG);
-  _settings.clear();
+  _settings_timer.stop();
+  int changed = 0;
+  const auto save = [this, &changed](const QString& key, const QVariant& value) {
+    /* Values read back from the file are strings, compare them as such. */
+    if (!_settings.contains(key) || _settings.value(key).toString() != value.toString()) {
+      _settings.setValue(key, value);
+      ++changed;
+    }
+  };
   _settings.beginGroup(QLatin1String("Notifications"));
-  _settings.setValue(QLatin1String("Inserted"), ui->notify_inserted->isChecked());
-  _settings.setValue(QLatin1String("Removed"), ui->notify_removed->isChecked());
-  _settings.setValue(QLatin1String("Allowed"), ui->notify_allowed->isChecked());
-  _settings.setValue(QLatin1String("Blocked"), ui->notify_blocked->isChecked());
-  _settings.setValue(QLatin1String("Rejected"), ui->notify_rejected->isChecked());
-  _settings.setValue(QLatin1String("Present"), ui->notify_present->isChecked());
+  save(QLatin1String("Inserted"), ui->notify_inserted->isChecked());
+  save(QLatin1String("Removed"), ui->notify_removed->isChecked());
+  save(QLatin1String("Allowed"), ui->notify_allowed->isChecked());
+  save(QLatin1String("Blocked"), ui->notify_blocked->isChecked());
+  save(QLatin1String("Rejected"), ui->notify_rejected->isChecked());
+  save(QLatin1String("Present"), ui->notify_present->isChecked());
   // Left as IPCStatus for compatibility.
-  _settings.setValue(QLatin1String("IPCStatus"), ui->notify_dbus->isChecked());
+  save(QLatin1String("IPCStatus"), ui->notify_dbus->isChecked());
   _settings.endGroup();
   _settings.beginGroup(QLatin1String("DeviceDialog"));
-  _settings.setValue(QLatin1String("DefaultDecision"), ui->default_decision_combobox->currentIndex());
-  _settings.setValue(QLatin1String("DefaultDecisionTimeout"), ui->decision_timeout->value());
-  _settings.setValue(QLatin1String("DecisionMethod"), ui->decision_method_combobox->currentIndex());
-  _settings.setValue(QLatin1String("DecisionIsPermanent"), ui->decision_permanent_checkbox->isChecked());
-  _settings.setValue(QLatin1String("ShowRejectButton"), ui->show_reject_button_checkbox->isChecked());
-  _settings.setValue(QLatin1String("RandomizeWindowPosition"), ui->randomize_position_checkbox->isChecked());
-  _settings.setValue(QLatin1String("MaskSerialNumber"), ui->mask_serial_checkbox->isChecked());
+  save(QLatin1String("DefaultDecision"), ui->default_decision_combobox->currentIndex());
+  save(QLatin1String("DefaultDecisionTimeout"), ui->decision_timeout->value());
+  save(QLatin1String("DecisionMethod"), ui->decision_method_combobox->currentIndex());
+  save(QLatin1String("DecisionIsPermanent"), ui->decision_permanent_checkbox->isChecked());
+  save(QLatin1String("ShowRejectButton"), ui->show_reject_button_checkbox->isChecked());
+  save(QLatin1String("RandomizeWindowPosition"), ui->randomize_position_checkbox->isChecked());
+  save(QLatin1String("MaskSerialNumber"), ui->mask_serial_checkbox->isChecked());
   _settings.endGroup();
-  _settings.sync();
+  qCDebug(LOG) << "changed=" << changed;
+
+  if (changed > 0) {
+    _settings.sync();
+  }
 }
 
 void MainWindow::loadDeviceList()
 {
   qCDebug(LOG);
+  auto watcher = new QDBusPendingCallWatcher(_bridge.listDevices(QLatin1String("match")), this);
+  QObject::connect(watcher, &QDBusPendingCallWatcher::finished,
+    this, &MainWindow::handleDeviceList);
+}
+
+void MainWindow::handleDeviceList(QDBusPendingCallWatcher* watcher)
+{
+  QDBusPendingReply<DBusRules> reply = *watcher;
+  watcher->deleteLater();
 
-  QDBusPendingReply<DBusRules> reply = _bridge.listDevices(QLatin1String("match"));
   if (!reply.isValid()) {
     showMessage(QString::fromLatin1("D-Bus call failed: %1: %2")
       .arg(QLatin1String("listDevices"))
       .arg(reply.error().message()),
       /*alert=*/true);
+    StartupTrace::finish("loadDeviceList", /*ok=*/false);
     return;
   }
 
@@ -578,13 +1005,24 @@ void MainWindow::loadDeviceList()
   for (auto rule : rules) {
     const auto device_rule_id = rule.first;
     if (!_device_model.containsDevice(device_rule_id)) {
-      auto device_rule = Rule::fromString(rule.second);
+      LazyRule device_rule(rule.second);
       device_rule.setRuleID(device_rule_id);
-      _device_model.insertDevice(device_rule);
+      insertDeviceTree(device_rule);
     }
   }
 
-  ui->device_view->expandAll();
+  StartupTrace::finish("loadDeviceList", /*ok=*/true);
+}
+
+void MainWindow::expandInsertedDevices(const QModelIndex& parent, int first, int last)
+{
+  /*
+   * Only the new rows are expanded, so that their children show up when
+   * they are inserted; the rest of the tree is left as it is.
+   */
+  for (int row = first; row <= last; ++row) {
+    ui->device_view->expand(_device_model.index(row, 0, parent));
+  }
 }
 
 void MainWindow::editDeviceListRow(const QModelIndex& index)
@@ -594,25 +1032,34 @@ void MainWindow::editDeviceListRow(const QModelIndex& index)
 
 void MainWindow::commitDeviceListChanges()
 {
-  auto modified_map = _device_model.getModifiedDevices();
-  auto modified_it = modified_map.begin();
-  const bool permanent = ui->permanent_checkbox->isChecked();
+  applyDevicePolicies(_device_model.getModifiedDevices(), ui->permanent_checkbox->isChecked());
+}
+
+void MainWindow::applyDevicePolicies(const QMap<quint32, Rule::Target>& targets, bool permanent)
+{
+  LOG_FIELDS({ "count", targets.count() }, { "permanent", permanent });
 
-  while (modified_it != modified_map.end()) {
-    auto id = modified_it.key();
-    auto target = modified_it.value();
+  /*
+   * All the calls are sent right away, and the results are collected as the
+   * replies arrive; the model and the log are updated once, after the last
+   * reply.
+   */
+  struct PolicyCommit {
+    int pending = 0;
+    int total = 0;
+    QMap<quint32, Rule::Target> applied;
+    QStringList failures;
+  };
+  auto commit = QSharedPointer<PolicyCommit>::create();
+
+  for (auto it = targets.constBegin(); it != targets.constEnd(); ++it) {
+    const quint32 id = it.key();
+    const Rule::Target target = it.value();
 
     switch (target) {
     case Rule::Target::Allow:
-      allowDevice(id, permanent);
-      break;
-
     case Rule::Target::Block:
-      blockDevice(id, permanent);
-      break;
-
     case Rule::Target::Reject:
-      rejectDevice(id, permanent);
       break;
 
     case Rule::Target::Match:
@@ -621,23 +1068,108 @@ void MainWindow::commitDeviceListChanges()
     case Rule::Target::Unknown:
     case Rule::Target::Device:
     default:
-      break;
+      continue;
     }
 
-    ++modified_it;
+    ++commit->pending;
+    ++commit->total;
+    auto watcher = new QDBusPendingCallWatcher(_bridge.applyDevicePolicy(id, target, permanent), this);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this,
+      [this, commit, id, target](QDBusPendingCallWatcher* watcher) {
+        QDBusPendingReply<uint> reply = *watcher;
+        watcher->deleteLater();
+
+        if (reply.isValid()) {
+          commit->applied.insert(id, target);
+        }
+        else {
+          commit->failures.append(QString::fromLatin1("%1 (%2)")
+            .arg(id).arg(reply.error().message()));
+        }
+
+        if (--commit->pending > 0) {
+          return;
+        }
+
+        _device_model.updateDeviceTargets(commit->applied);
+
+        if (commit->failures.isEmpty()) {
+          showMessage(QString::fromLatin1("Device policy applied: %1 device(s)")
+            .arg(commit->total));
+        }
+        else {
+          showMessage(QString::fromLatin1("Device policy applied: %1 of %2 device(s); D-Bus call failed: %3: %4")
+            .arg(commit->applied.count())
+            .arg(commit->total)
+            .arg(QLatin1String("applyDevicePolicy"))
+            .arg(commit->failures.join(QLatin1String(", "))),
+            /*alert=*/true);
+        }
+      });
   }
 }
 
 void MainWindow::clearDeviceList()
 {
+  _pending_devices.clear();
   _device_model.clear();
 }
 
 void MainWindow::resetDeviceList()
 {
-  clearDeviceList();
-  loadDeviceList();
-  ui->device_view->expandAll();
+  if (!_bridge.isConnected()) {
+    clearDeviceList();
+    return;
+  }
+
+  reconcileDeviceList(/*attempt=*/0);
+}
+
+void MainWindow::reconcileDeviceList(int attempt)
+{
+  /*
+   * Instead of rebuilding the tree, the fresh list is applied as a diff, so
+   * the views keep their selection, expansion and scroll position.
+   */
+  LOG_FIELDS({ "attempt", attempt });
+  const quint64 serial = _presence_serial;
+  auto watcher = new QDBusPendingCallWatcher(_bridge.listDevices(QLatin1String("match")), this);
+  QObject::connect(watcher, &QDBusPendingCallWatcher::finished,
+    this, [this, serial, attempt](QDBusPendingCallWatcher* watcher) {
+      QDBusPendingReply<DBusRules> reply = *watcher;
+      watcher->deleteLater();
+
+      if (!reply.isValid()) {
+        showMessage(QString::fromLatin1("D-Bus call failed: %1: %2")
+          .arg(QLatin1String("listDevices"))
+          .arg(reply.error().message()),
+          /*alert=*/true);
+        return;
+      }
+
+      /*
+       * Devices came or went while the list was on its way, and it may not
+       * have them: ask again rather than undo those changes.
+       */
+      if (serial != _presence_serial && attempt < 3) {
+        reconcileDeviceList(attempt + 1);
+        return;
+      }
+
+      const DBusRules rules = reply.value();
+      QList<LazyRule> devices;
+      devices.reserve(rules.count());
+
+      for (const auto& rule : rules) {
+        LazyRule device_rule(rule.second);
+        device_rule.setRuleID(rule.first);
+        devices.append(device_rule);
+      }
+
+      /* The devices waiting for their parent are all in the list. */
+      _pending_devices.clear();
+      _device_model.reconcile(devices);
+    });
 }
 
 void MainWindow::changeEvent(QEvent* e)
@@ -647,6 +1179,7 @@ void MainWindow::changeEvent(QEvent* e)
   if (e->type() == QEvent::LanguageChange) {
     qCDebug(LOG) << "QEvent::LanguageChange";
     ui->retranslateUi(this);
+    _device_model.retranslate();
   }
   else if (e->type() == QEvent::WindowStateChange) {
     qCDebug(LOG) << "QEvent::WindowStateChange";
@@ -20,13 +20,25 @@
 
 #include "DBusBridge.h"
 #include "DeviceModel.h"
+#include "Diagnostics.h"
+#include "EventJournal.h"
+#include "MessageModel.h"
 #include "TargetDelegate.h"
 
+#include <QElapsedTimer>
 #include <QSystemTrayIcon>
+#include <QIcon>
+#include <QList>
 #include <QMainWindow>
+#include <QMultiHash>
+#include <QPair>
+#include <QStringList>
 #include <QTimer>
 #include <QSettings>
 
+class QDBusPendingCallWatcher;
+class QPlainTextEdit;
+
 namespace Ui
 {
   class MainWindow;
@@ -37,69 +49,127 @@ class MainWindow : public QMainWindow
   Q_OBJECT
 
 public:
-  explicit MainWindow(QWidget* parent = nullptr);
+  explicit MainWindow(const QDBusConnection& bus = QDBusConnection::systemBus(), QWidget* parent = nullptr);
   ~MainWindow();
 
 protected Q_SLOTS:
   void switchVisibilityState(QSystemTrayIcon::ActivationReason reason);
   void flashStep();
   void dbusTryConnect();
+  void dbusConnectionFailed(const QString& message);
 
+  void showDeviceDialogs();
   void showDeviceDialog(quint32 id, const Rule& device_rule);
+  void showDeviceListDialog(const QList<QPair<quint32, LazyRule>>& devices);
   void showMessage(const QString& message, bool alert = false, bool statusbar = false);
-  void showNotification(QSystemTrayIcon::MessageIcon icon, const QString& title, const QString& message);
+  void showNotification(QSystemTrayIcon::MessageIcon icon, const QString& title, const QString& message,
+    quint32 device_id = 0);
 
+  void handleDeviceEvents(const DeviceEvents& events);
   void handleDevicePresenceChange(uint id,
     DeviceManager::EventType event,
     Rule::Target target,
-    const QString& device_rule);
+    const LazyRule& device_rule);
 
   void handleDevicePolicyChange(uint id,
     Rule::Target target_old,
     Rule::Target target_new,
-    const QString& device_rule,
+    const LazyRule& device_rule,
     uint rule_id);
 
   void notifyDBusConnected();
   void notifyDBusDisconnected();
-  void notifyDevicePresenceChanged(DeviceManager::EventType event, const Rule& device_rule);
-  void notifyDevicePolicyChanged(const Rule& device_rule, quint32 rule_id);
-  void notify(const QString& title, QSystemTrayIcon::MessageIcon icon, const Rule& device_rule, bool show_notification);
+  void notifyDevicePresenceChanged(DeviceManager::EventType event, const LazyRule& device_rule);
+  void notifyDevicePolicyChanged(const LazyRule& device_rule, quint32 rule_id);
+  void notify(const QString& title, QSystemTrayIcon::MessageIcon icon, const LazyRule& device_rule, bool show_notification,
+    EventJournal::Event journal_event);
 
   void allowDevice(quint32 id, bool permanent);
   void blockDevice(quint32 id, bool permanent);
   void rejectDevice(quint32 id, bool permanent);
+  void applyDevicePolicy(quint32 id, Rule::Target target, bool permanent, const QString& call_name);
 
   void handleDBusConnect();
   void handleDBusDisconnect();
 
-  void handleDeviceInsert(quint32 id, const Rule& device_rule);
-  void handleDeviceRemove(quint32 id, const Rule& device_rule);
+  void handleDeviceInsert(quint32 id, const LazyRule& device_rule);
+  void handleDeviceRemove(quint32 id, const LazyRule& device_rule);
+  void insertDevice(const LazyRule& device_rule);
+  void insertDeviceTree(const LazyRule& device_rule);
+  void loadParentDevice(const QString& parent_hash);
 
   void loadSettings();
+  void scheduleSaveSettings();
   void saveSettings();
 
   void loadDeviceList();
+  void handleDeviceList(QDBusPendingCallWatcher* watcher);
+  void expandInsertedDevices(const QModelIndex& parent, int first, int last);
   void editDeviceListRow(const QModelIndex& index);
   void commitDeviceListChanges();
+  void applyDevicePolicies(const QMap<quint32, Rule::Target>& targets, bool permanent);
   void clearDeviceList();
   void resetDeviceList();
+  void reconcileDeviceList(int attempt);
 
   void changeEvent(QEvent* e) override;
+  bool eventFilter(QObject* object, QEvent* event) override;
   void closeEvent(QCloseEvent* e) override;
 
   void setupSystemTray();
   void setupSettingsWatcher();
+  void setupDiagnostics();
+  void toggleDiagnosticsTab();
+  void refreshDiagnostics();
   void startFlashing();
   void stopFlashing();
 
 private:
+  enum class TrayState {
+    Inactive = 0,
+    Active = 1,
+    Warning = 2,
+  };
+  static const int TrayStateCount = 3;
+
+  void loadTrayIcons();
+  void setTrayState(TrayState state);
+  TrayState idleTrayState() const;
+  void followJournal();
+  void appendMessages(const QList<MessageModel::Message>& messages);
+  void flushBatchedMessages();
+  Rule::Target defaultDecision() const;
+
+  struct Notification
+  {
+    QSystemTrayIcon::MessageIcon icon;
+    QString title;
+    QString message;
+    quint32 device_id;
+  };
+
   Ui::MainWindow* ui;
   QSystemTrayIcon* systray;
+  QIcon _tray_icons[TrayStateCount];
+  TrayState _tray_state;
   QTimer _flash_timer;
   bool _flash_state;
   QSettings _settings;
+  QTimer _settings_timer;
   DeviceModel _device_model;
+  MessageModel _message_model;
+  EventJournal _journal;
+  EventJournalModel _journal_model;
+  QMultiHash<QString, LazyRule> _pending_devices;
+  quint64 _presence_serial = 0;
+  bool _batch_messages = false;
+  QList<MessageModel::Message> _batched_messages;
+  QList<Notification> _batched_notifications;
+  QList<QPair<quint32, LazyRule>> _pending_decisions;
+  Diagnostics _diagnostics;
+  QPlainTextEdit* _diagnostics_text = nullptr;
+  QTimer _diagnostics_timer;
+  QElapsedTimer _relayout_timer;
   TargetDelegate _target_delegate;
   DBusBridge _bridge;
 };
@@ -0,0 +1,120 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+
+#include "MessageModel.h"
+
+#include <QFont>
+
+#include <algorithm>
+
+const int MessageModel::DefaultCapacity = 2000;
+
+MessageModel::MessageModel(int capacity, QObject* parent) :
+  QAbstractListModel(parent),
+  _capacity(qMax(capacity, 1))
+{
+  _messages.reserve(_capacity);
+}
+
+MessageModel::~MessageModel()
+{
+}
+
+int MessageModel::rowCount(const QModelIndex& parent) const
+{
+  if (parent.isValid()) {
+    return 0;
+  }
+
+  return _count;
+}
+
+QVariant MessageModel::data(const QModelIndex& index, int role) const
+{
+  if (!index.isValid() || index.row() >= _count) {
+    return QVariant();
+  }
+
+  const Message& message = messageAt(index.row());
+
+  switch (role) {
+  case Qt::DisplayRole:
+  case Qt::ToolTipRole:
+    return message.text;
+
+  case Qt::FontRole:
+    if (message.alert) {
+      QFont font;
+      font.setBold(true);
+      return font;
+    }
+
+    return QVariant();
+
+  default:
+    return QVariant();
+  }
+}
+
+void MessageModel::appendMessage(const QString& text, bool alert)
+{
+  appendMessages(QList<Message>() << Message{ text, alert });
+}
+
+void MessageModel::appendMessages(const QList<Message>& messages)
+{
+  if (messages.isEmpty()) {
+    return;
+  }
+
+  // Only the last messages of a batch bigger than the capacity are kept.
+  const int new_count = std::min<int>(messages.count(), _capacity);
+  const int overflow = _count + new_count - _capacity;
+
+  if (overflow > 0) {
+    beginRemoveRows(QModelIndex(), 0, overflow - 1);
+    _first = (_first + overflow) % _capacity;
+    _count -= overflow;
+    endRemoveRows();
+  }
+
+  beginInsertRows(QModelIndex(), _count, _count + new_count - 1);
+
+  for (int i = messages.count() - new_count; i < messages.count(); ++i) {
+    const int slot = (_first + _count) % _capacity;
+
+    if (slot < _messages.count()) {
+      _messages[slot] = messages.at(i);
+    }
+    else {
+      _messages.append(messages.at(i));
+    }
+
+    ++_count;
+  }
+
+  endInsertRows();
+}
+
+const MessageModel::Message& MessageModel::messageAt(int row) const
+{
+  return _messages.at((_first + row) % _capacity);
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,62 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+#pragma once
+
+#include <QAbstractListModel>
+#include <QList>
+#include <QString>
+#include <QVariant>
+
+/*
+ * The messages shown in the log tab. Only the most recent messages are
+ * kept, in a ring buffer of fixed capacity, so appending never moves the
+ * existing ones.
+ */
+class MessageModel : public QAbstractListModel
+{
+  Q_OBJECT
+
+public:
+  struct Message
+  {
+    QString text;
+    bool alert;
+  };
+
+  explicit MessageModel(int capacity = DefaultCapacity, QObject* parent = nullptr);
+  ~MessageModel();
+
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+  void appendMessage(const QString& text, bool alert);
+  void appendMessages(const QList<Message>& messages);
+
+  static const int DefaultCapacity;
+
+private:
+  const Message& messageAt(int row) const;
+
+  QList<Message> _messages;
+  int _capacity;
+  int _first = 0;
+  int _count = 0;
+};
+
+/* vim: set ts=2 sw=2 et */
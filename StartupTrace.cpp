@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+
+#include "StartupTrace.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QList>
+
+#include <utility>
+
+namespace
+{
+  struct Phase
+  {
+    const char* name;
+    qint64 end;   /* nsecs since enable() */
+  };
+
+  QElapsedTimer timer;
+  QList<Phase> phases;
+  bool benchmark = false;
+  bool finished = false;
+}
+
+bool StartupTrace::_enabled = false;
+
+void StartupTrace::enable(bool benchmark_mode)
+{
+  _enabled = true;
+  benchmark = benchmark_mode;
+  timer.start();
+}
+
+void StartupTrace::mark(const char* phase)
+{
+  if (!_enabled || finished) {
+    return;
+  }
+
+  phases.append(Phase{ phase, timer.nsecsElapsed() });
+}
+
+void StartupTrace::finish(const char* phase, bool ok)
+{
+  if (!_enabled || finished) {
+    return;
+  }
+
+  mark(phase);
+  finished = true;
+
+  if (benchmark) {
+    /* Queued, as this can happen before the event loop is running. */
+    QMetaObject::invokeMethod(QCoreApplication::instance(), [ok]() {
+        QCoreApplication::exit(ok ? 0 : 1);
+      }, Qt::QueuedConnection);
+  }
+}
+
+QString StartupTrace::report()
+{
+  /* One "phase<TAB>phase ms<TAB>total ms" line per phase, for scripts. */
+  QString result;
+  qint64 previous = 0;
+
+  for (const Phase& phase : std::as_const(phases)) {
+    result += QString::fromLatin1("%1\t%2\t%3\n")
+      .arg(QLatin1String(phase.name))
+      .arg((phase.end - previous) / 1e6, 0, 'f', 3)
+      .arg(phase.end / 1e6, 0, 'f', 3);
+    previous = phase.end;
+  }
+
+  if (!finished) {
+    result += QLatin1String("# startup did not complete\n");
+  }
+
+  return result;
+}
+
+/* vim: set ts=2 sw=2 et */
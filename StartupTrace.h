@@ -0,0 +1,52 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+#pragma once
+
+#include <QString>
+
+/*
+ * Opt-in timing of the startup phases (--trace-startup). Each mark()
+ * records how long passed since the previous one on a monotonic clock;
+ * when tracing is not enabled, marks cost a single check.
+ *
+ * With --benchmark-startup the application also quits once the startup is
+ * over, i.e. when the first device list is loaded, or when connecting to
+ * the service fails.
+ */
+class StartupTrace
+{
+public:
+  static void enable(bool benchmark);
+  static bool isEnabled();
+
+  static void mark(const char* phase);
+  static void finish(const char* phase, bool ok);
+
+  static QString report();
+
+private:
+  static bool _enabled;
+};
+
+inline bool StartupTrace::isEnabled()
+{
+  return _enabled;
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,651 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+
+#include "DBusTypes.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTimer>
+
+#include <cstdio>
+#include <memory>
+
+#include <signal.h>
+
+/*
+ * Event storm benchmark: starts a private dbus-daemon, registers a mock
+ * org.usbguard1 service on it, and runs the applet against that bus. Once
+ * the applet has listed the devices, rounds of insertions, policy changes
+ * and removals are sent at the requested rate.
+ *
+ * The throughput of the applet comes from its own diagnostics counters,
+ * not from the sending rate: the diagnostics are dumped (SIGUSR1) before
+ * the storm, and then polled after it until the applet received all the
+ * events and stopped updating the model. The events it received, over the
+ * time between the first dump and the last one that still showed progress,
+ * is its throughput. The per-stage histograms and the peak RSS of the
+ * applet are printed too.
+ */
+
+namespace
+{
+  const QString service = QLatin1String("org.usbguard1");
+  const QString devices_path = QLatin1String("/org/usbguard1/Devices");
+  const QString devices_interface = QLatin1String("org.usbguard.Devices1");
+
+  /* Not ImplicitID, so that the applet does not ask about the devices. */
+  const uint storm_rule_id = 1;
+
+  const QString signal_receive_stage = QLatin1String("signal_receive");
+  const QString model_update_stage = QLatin1String("model_update");
+
+  /* The SIGUSR1 dumps are polled this often. */
+  const int poll_interval = 100; /* msecs */
+
+  enum class Target : uint {
+    Allow = 0,
+    Block = 1,
+  };
+
+  enum class PresenceEvent : uint {
+    Insert = 1,
+    Remove = 3,
+  };
+
+  struct Device
+  {
+    uint id;
+    QString rule;
+    DBusAttributes attributes;
+  };
+
+  QString deviceHash(int index)
+  {
+    const QByteArray seed = QByteArray::number(index);
+    return QString::fromLatin1(QCryptographicHash::hash(seed, QCryptographicHash::Sha256).toBase64());
+  }
+
+  QString deviceRule(Target target, const DBusAttributes& attributes)
+  {
+    return QString::fromLatin1("%1 id %2 serial \"%3\" name \"%4\" hash \"%5\" parent-hash \"%6\" via-port \"%7\" with-interface %8")
+      .arg(target == Target::Allow ? QLatin1String("allow") : QLatin1String("block"))
+      .arg(attributes.value(QLatin1String("id")), attributes.value(QLatin1String("serial")),
+        attributes.value(QLatin1String("name")), attributes.value(QLatin1String("hash")),
+        attributes.value(QLatin1String("parent-hash")), attributes.value(QLatin1String("via-port")),
+        attributes.value(QLatin1String("with-interface")));
+  }
+
+  Device createDevice(int index)
+  {
+    /* All the devices hang off a single hub, the device 0. */
+    Device device;
+    device.id = uint(index) + 1;
+    device.attributes.insert(QLatin1String("id"), QLatin1String("1d6b:0002"));
+    device.attributes.insert(QLatin1String("serial"), QString::number(index));
+    device.attributes.insert(QLatin1String("name"), QString::fromLatin1("Storm device %1").arg(index));
+    device.attributes.insert(QLatin1String("hash"), deviceHash(index));
+    device.attributes.insert(QLatin1String("parent-hash"), deviceHash(index > 0 ? 0 : -1));
+    device.attributes.insert(QLatin1String("via-port"), QString::fromLatin1("1-%1").arg(index));
+    device.attributes.insert(QLatin1String("with-interface"),
+      index > 0 ? QLatin1String("03:01:01") : QLatin1String("09:00:00"));
+    device.attributes.insert(QLatin1String("with-connect-type"), QLatin1String("hotplug"));
+    device.rule = deviceRule(Target::Block, device.attributes);
+    return device;
+  }
+
+  /* The upper bound of a bucket of the log2 histograms of Diagnostics. */
+  qint64 bucketLimit(int bucket)
+  {
+    return qint64(1) << (bucket + 1);
+  }
+
+  QJsonObject stageStats(const QJsonObject& diagnostics, const QString& stage)
+  {
+    return diagnostics.value(QLatin1String("stages")).toObject().value(stage).toObject();
+  }
+
+  qint64 stageCount(const QJsonObject& diagnostics, const QString& stage)
+  {
+    return stageStats(diagnostics, stage).value(QLatin1String("count")).toInteger();
+  }
+
+  qint64 dumpTime(const QJsonObject& diagnostics)
+  {
+    return QDateTime::fromString(diagnostics.value(QLatin1String("time")).toString(),
+      Qt::ISODateWithMs).toMSecsSinceEpoch();
+  }
+
+  /* The samples of the histogram recorded after the baseline. */
+  QList<qint64> histogramDelta(const QJsonObject& stage, const QJsonObject& baseline)
+  {
+    const QJsonArray histogram = stage.value(QLatin1String("histogram_log2_us")).toArray();
+    const QJsonArray baseline_histogram = baseline.value(QLatin1String("histogram_log2_us")).toArray();
+    QList<qint64> delta;
+
+    for (int bucket = 0; bucket < histogram.size(); ++bucket) {
+      delta.append(histogram.at(bucket).toInteger() - baseline_histogram.at(bucket).toInteger());
+    }
+
+    return delta;
+  }
+
+  qint64 percentile(const QList<qint64>& histogram, qint64 count, double fraction)
+  {
+    const qint64 wanted = qMax<qint64>(1, qint64(fraction * count + 0.5));
+    qint64 seen = 0;
+
+    for (int bucket = 0; bucket < histogram.size(); ++bucket) {
+      seen += histogram.at(bucket);
+
+      if (seen >= wanted) {
+        return bucketLimit(bucket);
+      }
+    }
+
+    return bucketLimit(int(histogram.size()) - 1);
+  }
+}
+
+class MockService : public QObject
+{
+  Q_OBJECT
+  Q_CLASSINFO("D-Bus Interface", "org.usbguard1")
+
+public:
+  using QObject::QObject;
+
+public Q_SLOTS:
+  QString getParameter(const QString& name)
+  {
+    (void)name;
+    return QLatin1String("block");
+  }
+};
+
+class MockDevices : public QObject
+{
+  Q_OBJECT
+  Q_CLASSINFO("D-Bus Interface", "org.usbguard.Devices1")
+
+public:
+  explicit MockDevices(const QDBusConnection& bus, QObject* parent = nullptr) :
+    QObject(parent),
+    _bus(bus)
+  {
+  }
+
+  void insertDevice(const Device& device)
+  {
+    _present.insert(device.id, device);
+    sendPresenceChanged(device, PresenceEvent::Insert, Target::Block);
+  }
+
+  void removeDevice(const Device& device)
+  {
+    _present.remove(device.id);
+    sendPresenceChanged(device, PresenceEvent::Remove, Target::Block);
+  }
+
+  void allowDevice(const Device& device)
+  {
+    QDBusMessage message = QDBusMessage::createSignal(devices_path, devices_interface,
+      QLatin1String("DevicePolicyChanged"));
+    message << device.id << uint(Target::Block) << uint(Target::Allow)
+      << deviceRule(Target::Allow, device.attributes) << storm_rule_id
+      << QVariant::fromValue(device.attributes);
+    _bus.send(message);
+  }
+
+public Q_SLOTS:
+  DBusRules listDevices(const QString& query)
+  {
+    (void)query;
+    DBusRules rules;
+
+    for (const Device& device : std::as_const(_present)) {
+      rules.append(DBusRule(device.id, device.rule));
+    }
+
+    Q_EMIT listed();
+    return rules;
+  }
+
+  uint applyDevicePolicy(uint id, uint target, bool permanent)
+  {
+    (void)id;
+    (void)target;
+    (void)permanent;
+    return storm_rule_id;
+  }
+
+Q_SIGNALS:
+  void listed();
+
+private:
+  void sendPresenceChanged(const Device& device, PresenceEvent event, Target target)
+  {
+    QDBusMessage message = QDBusMessage::createSignal(devices_path, devices_interface,
+      QLatin1String("DevicePresenceChanged"));
+    message << device.id << uint(event) << uint(target) << device.rule
+      << QVariant::fromValue(device.attributes);
+    _bus.send(message);
+  }
+
+  QDBusConnection _bus;
+  QHash<uint, Device> _present;
+};
+
+class StormBenchmark : public QObject
+{
+  Q_OBJECT
+
+public:
+  struct Options
+  {
+    QString applet;
+    int devices = 200;
+    int rounds = 5;
+    int rate = 2000;  /* events/sec, 0 for as fast as possible */
+    int settle = 5000;  /* msecs without progress before giving up */
+  };
+
+  explicit StormBenchmark(const Options& options) :
+    _options(options)
+  {
+    for (int i = 0; i <= _options.devices; ++i) {
+      _devices.append(createDevice(i));
+    }
+
+    /* Each round: insert all the devices, allow them, remove them. */
+    for (int round = 0; round < _options.rounds; ++round) {
+      for (const StormStep::Kind kind : { StormStep::Insert, StormStep::Allow, StormStep::Remove }) {
+        for (int i = 1; i <= _options.devices; ++i) {
+          _steps.append(StormStep{ kind, i });
+        }
+      }
+    }
+
+    _send_timer.setInterval(10);
+    QObject::connect(&_send_timer, &QTimer::timeout, this, &StormBenchmark::sendSteps);
+  }
+
+  ~StormBenchmark()
+  {
+    QObject::disconnect(&_applet, nullptr, this, nullptr);
+    stopProcess(_applet);
+    stopProcess(_daemon);
+  }
+
+  bool start()
+  {
+    if (!_home.isValid()) {
+      std::fprintf(stderr, "Cannot create a temporary directory\n");
+      return false;
+    }
+
+    _daemon.setProgram(QLatin1String("dbus-daemon"));
+    _daemon.setArguments({ QLatin1String("--session"), QLatin1String("--nofork"),
+      QLatin1String("--print-address=1") });
+    _daemon.start();
+
+    if (!_daemon.waitForStarted() || !_daemon.waitForReadyRead(5000)) {
+      std::fprintf(stderr, "Cannot start dbus-daemon\n");
+      return false;
+    }
+
+    const QString address = QString::fromLocal8Bit(_daemon.readLine().trimmed());
+    _bus = std::make_unique<QDBusConnection>(QDBusConnection::connectToBus(address, QLatin1String("storm")));
+
+    if (!_bus->isConnected()) {
+      std::fprintf(stderr, "Cannot connect to %s\n", qPrintable(address));
+      return false;
+    }
+
+    _mock_service = new MockService(this);
+    _mock_devices = new MockDevices(*_bus, this);
+    _bus->registerObject(QLatin1String("/org/usbguard1"), _mock_service, QDBusConnection::ExportAllSlots);
+    _bus->registerObject(devices_path, _mock_devices, QDBusConnection::ExportAllSlots);
+
+    /* The hub stays for the whole run, the storm happens below it. */
+    _mock_devices->insertDevice(_devices.first());
+
+    if (!_bus->registerService(service)) {
+      std::fprintf(stderr, "Cannot register %s\n", qPrintable(service));
+      return false;
+    }
+
+    QObject::connect(_mock_devices, &MockDevices::listed, this, &StormBenchmark::startStorm,
+      Qt::SingleShotConnection);
+
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert(QLatin1String("QT_QPA_PLATFORM"), QLatin1String("offscreen"));
+    environment.insert(QLatin1String("XDG_CONFIG_HOME"), _home.filePath(QLatin1String("config")));
+    environment.insert(QLatin1String("XDG_DATA_HOME"), _home.filePath(QLatin1String("data")));
+    _applet.setProcessEnvironment(environment);
+    _applet.setProcessChannelMode(QProcess::ForwardedChannels);
+    _applet.setProgram(_options.applet);
+    _applet.setArguments({ QLatin1String("--bus"), address });
+    QObject::connect(&_applet, &QProcess::finished, this, []() {
+        std::fprintf(stderr, "The applet exited\n");
+        QCoreApplication::exit(1);
+      });
+    _applet.start();
+
+    if (!_applet.waitForStarted()) {
+      std::fprintf(stderr, "Cannot start %s\n", qPrintable(_options.applet));
+      return false;
+    }
+
+    QTimer::singleShot(10000, this, [this]() {
+        if (!_storm_timer.isValid()) {
+          std::fprintf(stderr, "The applet did not list the devices\n");
+          QCoreApplication::exit(1);
+        }
+      });
+    return true;
+  }
+
+private:
+  struct StormStep
+  {
+    enum Kind {
+      Insert,
+      Allow,
+      Remove,
+    };
+
+    Kind kind;
+    int device;
+  };
+
+  void startStorm()
+  {
+    /* The baseline dump: the counters from the listing are not the storm. */
+    requestDiagnostics();
+  }
+
+  void startSending()
+  {
+    std::printf("Sending %lld events to the applet...\n", qlonglong(_steps.size()));
+    _storm_timer.start();
+    _send_timer.start();
+  }
+
+  void sendSteps()
+  {
+    /* The number of events due by now, for the requested rate. */
+    const qint64 due = _options.rate > 0 ?
+      qMin<qint64>(_steps.size(), _storm_timer.elapsed() * _options.rate / 1000 + 1) : _steps.size();
+
+    for (; _sent < due; ++_sent) {
+      const StormStep& step = _steps.at(_sent);
+      const Device& device = _devices.at(step.device);
+
+      switch (step.kind) {
+      case StormStep::Insert:
+        _mock_devices->insertDevice(device);
+        break;
+
+      case StormStep::Allow:
+        _mock_devices->allowDevice(device);
+        break;
+
+      case StormStep::Remove:
+        _mock_devices->removeDevice(device);
+        break;
+      }
+    }
+
+    _bus->flush();
+
+    if (_sent == _steps.size()) {
+      _send_timer.stop();
+      _storm_elapsed = _storm_timer.elapsed();
+      requestDiagnostics();
+    }
+  }
+
+  void requestDiagnostics()
+  {
+    ::kill(pid_t(_applet.processId()), SIGUSR1);
+    _diagnostics_timer.start();
+    QTimer::singleShot(poll_interval, this, &StormBenchmark::readDiagnostics);
+  }
+
+  void readDiagnostics()
+  {
+    /* A dump is new when its time differs from the one of the previous dump. */
+    QDirIterator it(_home.filePath(QLatin1String("data")), { QLatin1String("diagnostics.json") },
+      QDir::Files, QDirIterator::Subdirectories);
+    QJsonObject diagnostics;
+
+    if (it.hasNext()) {
+      QFile file(it.next());
+
+      if (file.open(QIODevice::ReadOnly)) {
+        diagnostics = QJsonDocument::fromJson(file.readAll()).object();
+      }
+    }
+
+    const QJsonValue time = diagnostics.value(QLatin1String("time"));
+
+    if (time.isUndefined() || time == _last.value(QLatin1String("time"))) {
+      if (_diagnostics_timer.elapsed() > 5000) {
+        std::fprintf(stderr, "The applet did not write its diagnostics\n");
+        QCoreApplication::exit(1);
+      }
+      else {
+        QTimer::singleShot(poll_interval, this, &StormBenchmark::readDiagnostics);
+      }
+
+      return;
+    }
+
+    diagnosticsWritten(diagnostics);
+  }
+
+  void diagnosticsWritten(const QJsonObject& diagnostics)
+  {
+    if (_baseline.isEmpty()) {
+      _baseline = diagnostics;
+      _last = diagnostics;
+      _last_progress = diagnostics;
+      startSending();
+      return;
+    }
+
+    const bool progress =
+      stageCount(diagnostics, signal_receive_stage) != stageCount(_last, signal_receive_stage) ||
+      stageCount(diagnostics, model_update_stage) != stageCount(_last, model_update_stage);
+    _last = diagnostics;
+
+    if (progress) {
+      _last_progress = diagnostics;
+    }
+
+    const qint64 received = stageCount(_last_progress, signal_receive_stage) -
+      stageCount(_baseline, signal_receive_stage);
+    const bool stalled = dumpTime(diagnostics) - dumpTime(_last_progress) > _options.settle;
+
+    /* Done when everything arrived, and one more dump showed nothing new. */
+    if ((received >= _sent && !progress) || stalled) {
+      _peak_rss = peakRss();
+      report();
+      QCoreApplication::exit(received >= _sent ? 0 : 1);
+      return;
+    }
+
+    QTimer::singleShot(poll_interval, this, &StormBenchmark::requestDiagnostics);
+  }
+
+  void report()
+  {
+    const qint64 received = stageCount(_last_progress, signal_receive_stage) -
+      stageCount(_baseline, signal_receive_stage);
+    const qint64 model_updates = stageCount(_last_progress, model_update_stage) -
+      stageCount(_baseline, model_update_stage);
+    const qint64 handling_elapsed = dumpTime(_last_progress) - dumpTime(_baseline);
+
+    std::printf("sent: %lld events in %lld ms (%.0f events/s, capped by --rate)\n",
+      qlonglong(_sent), qlonglong(_storm_elapsed),
+      _storm_elapsed > 0 ? _sent * 1000.0 / _storm_elapsed : 0.0);
+    std::printf("applet: received %lld events, %lld model updates in %lld ms (%.0f events/s, +/- %d ms)\n",
+      qlonglong(received), qlonglong(model_updates), qlonglong(handling_elapsed),
+      handling_elapsed > 0 ? received * 1000.0 / handling_elapsed : 0.0, poll_interval);
+
+    if (received < _sent) {
+      std::printf("applet: %lld events were not received\n", qlonglong(_sent - received));
+    }
+
+    std::printf("applet peak RSS: %lld kB\n", qlonglong(_peak_rss));
+    std::printf("Per-stage time inside the applet during the storm (not end-to-end latency):\n");
+
+    const QJsonObject stages = _last_progress.value(QLatin1String("stages")).toObject();
+
+    for (auto it = stages.constBegin(); it != stages.constEnd(); ++it) {
+      const QJsonObject stage = it.value().toObject();
+      const QJsonObject baseline = stageStats(_baseline, it.key());
+      const qint64 count = stage.value(QLatin1String("count")).toInteger() -
+        baseline.value(QLatin1String("count")).toInteger();
+      const qint64 total_us = stage.value(QLatin1String("total_us")).toInteger() -
+        baseline.value(QLatin1String("total_us")).toInteger();
+      const QList<qint64> histogram = histogramDelta(stage, baseline);
+
+      if (count <= 0) {
+        continue;
+      }
+
+      std::printf("  %-16s count %8lld  mean %8.1f us  p50 < %lld us  p99 < %lld us  max %lld us (whole run)\n",
+        qPrintable(it.key()), qlonglong(count), double(total_us) / count,
+        qlonglong(percentile(histogram, count, 0.50)),
+        qlonglong(percentile(histogram, count, 0.99)),
+        qlonglong(stage.value(QLatin1String("max_us")).toInteger()));
+    }
+  }
+
+  qint64 peakRss() const
+  {
+    QFile status(QString::fromLatin1("/proc/%1/status").arg(_applet.processId()));
+
+    if (!status.open(QIODevice::ReadOnly)) {
+      return -1;
+    }
+
+    for (;;) {
+      const QByteArray line = status.readLine();
+
+      if (line.isEmpty()) {
+        return -1;
+      }
+
+      if (line.startsWith("VmHWM:")) {
+        return line.mid(6).trimmed().split(' ').first().toLongLong();
+      }
+    }
+  }
+
+  static void stopProcess(QProcess& process)
+  {
+    if (process.state() == QProcess::NotRunning) {
+      return;
+    }
+
+    process.terminate();
+
+    if (!process.waitForFinished(3000)) {
+      process.kill();
+      process.waitForFinished();
+    }
+  }
+
+  Options _options;
+  QTemporaryDir _home;
+  QProcess _daemon;
+  QProcess _applet;
+  std::unique_ptr<QDBusConnection> _bus;
+  MockService* _mock_service = nullptr;
+  MockDevices* _mock_devices = nullptr;
+  QList<Device> _devices;
+  QList<StormStep> _steps;
+  qint64 _sent = 0;
+  QTimer _send_timer;
+  QElapsedTimer _storm_timer;
+  qint64 _storm_elapsed = 0;
+  QElapsedTimer _diagnostics_timer;
+  QJsonObject _baseline;
+  QJsonObject _last;
+  QJsonObject _last_progress;
+  qint64 _peak_rss = -1;
+};
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication a(argc, argv);
+  qDBusRegisterMetaType<DBusRule>();
+  qDBusRegisterMetaType<DBusRules>();
+  qDBusRegisterMetaType<DBusAttributes>();
+
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  const QCommandLineOption applet_option(QLatin1String("applet"),
+    QLatin1String("The applet to run."), QLatin1String("path"), QLatin1String(APPLET_PATH));
+  const QCommandLineOption devices_option(QLatin1String("devices"),
+    QLatin1String("The devices inserted and removed in each round."), QLatin1String("count"), QLatin1String("200"));
+  const QCommandLineOption rounds_option(QLatin1String("rounds"),
+    QLatin1String("The rounds of the storm."), QLatin1String("count"), QLatin1String("5"));
+  const QCommandLineOption rate_option(QLatin1String("rate"),
+    QLatin1String("The events sent per second, 0 for as fast as possible."), QLatin1String("events"), QLatin1String("2000"));
+  parser.addOption(applet_option);
+  parser.addOption(devices_option);
+  parser.addOption(rounds_option);
+  parser.addOption(rate_option);
+  parser.process(a);
+
+  StormBenchmark::Options options;
+  options.applet = parser.value(applet_option);
+  options.devices = qMax(1, parser.value(devices_option).toInt());
+  options.rounds = qMax(1, parser.value(rounds_option).toInt());
+  options.rate = qMax(0, parser.value(rate_option).toInt());
+
+  StormBenchmark benchmark(options);
+
+  if (!benchmark.start()) {
+    return 1;
+  }
+
+  return a.exec();
+}
+
+#include "StormBenchmark.moc"
+
+/* vim: set ts=2 sw=2 et */
@@ -19,16 +19,40 @@
 
 #include "MainWindow.h"
 #include "Log.h"
+#include "StartupTrace.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QLocale>
 #include <QTranslator>
 #include <QString>
 
+#include <cstdio>
+
 int main(int argc, char* argv[])
 {
   QCoreApplication::setAttribute(Qt::AA_DisableSessionManager, true);
   QApplication a(argc, argv);
+
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  const QCommandLineOption trace_option(QLatin1String("trace-startup"),
+    QCoreApplication::translate("main", "Print how long each startup phase took, on exit."));
+  const QCommandLineOption benchmark_option(QLatin1String("benchmark-startup"),
+    QCoreApplication::translate("main", "Like --trace-startup, and quit once the device list is loaded."));
+  const QCommandLineOption bus_option(QLatin1String("bus"),
+    QCoreApplication::translate("main", "The D-Bus bus of the USBGuard service: system (the default), session, "
+      "or the address of a bus. Overrides the USBGUARD_APPLET_BUS environment variable."),
+    QLatin1String("bus"));
+  parser.addOption(trace_option);
+  parser.addOption(benchmark_option);
+  parser.addOption(bus_option);
+  parser.process(a);
+
+  if (parser.isSet(trace_option) || parser.isSet(benchmark_option)) {
+    StartupTrace::enable(/*benchmark=*/parser.isSet(benchmark_option));
+  }
+
   QTranslator translator;
   qCDebug(LOG) << "Loading translations for locale: "
     << QLocale::system().name();
@@ -44,9 +68,20 @@ int main(int argc, char* argv[])
     qCDebug(LOG) << "Translations not available for the current locale.";
   }
 
-  MainWindow w;
+  StartupTrace::mark("translations");
+  const QString bus = parser.isSet(bus_option) ?
+    parser.value(bus_option) : qEnvironmentVariable("USBGUARD_APPLET_BUS");
+  qCDebug(LOG) << "Using bus:" << (bus.isEmpty() ? QLatin1String("system") : bus);
+  MainWindow w(DBusBridge::connectionFromString(bus));
   a.setQuitOnLastWindowClosed(false);
-  return a.exec();
+  const int result = a.exec();
+  StructuredLog::shutdown();
+
+  if (StartupTrace::isEnabled()) {
+    std::fputs(StartupTrace::report().toLocal8Bit().constData(), stderr);
+  }
+
+  return result;
 }
 
 /* vim: set ts=2 sw=2 et */
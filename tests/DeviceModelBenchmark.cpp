@@ -0,0 +1,377 @@
+//
+// Copyright (C) 2026 Pino Toscano
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Authors: Pino Toscano <toscano.pino@tiscali.it>
+//
+
+#include "DeviceModel.h"
+
+#include <QCryptographicHash>
+#include <QPixmap>
+#include <QTest>
+#include <QTreeView>
+
+/*
+ * Benchmarks of the DeviceModel hot paths on synthetic trees of hubs, each
+ * with up to HubPorts children, as they would come from usbguard: the
+ * devices are built from the rule text and the D-Bus attributes, so no
+ * daemon is needed.
+ */
+class DeviceModelBenchmark : public QObject
+{
+  Q_OBJECT
+
+private Q_SLOTS:
+  void insertTopLevelDevice();
+  void insertDevice_data();
+  void insertDevice();
+  void removeDevice_data();
+  void removeDevice();
+  void removeLastChild_data();
+  void removeLastChild();
+  void lastChildIndex_data();
+  void lastChildIndex();
+  void containsDeviceHash_data();
+  void containsDeviceHash();
+  void updateDeviceTarget_data();
+  void updateDeviceTarget();
+  void getModifiedDevices_data();
+  void getModifiedDevices();
+  void data_data();
+  void data();
+  void paint_data();
+  void paint();
+
+private:
+  static const int HubPorts = 8;
+
+  static void addSizes();
+  static QString deviceHash(int index);
+  static LazyRule createDevice(int index, int parent_index, bool hub);
+  static QList<LazyRule> createDevices(int count, int ports = HubPorts);
+  static void fillModel(DeviceModel& model, const QList<LazyRule>& devices);
+  static int readAll(const DeviceModel& model, const QModelIndex& parent);
+};
+
+void DeviceModelBenchmark::addSizes()
+{
+  QTest::addColumn<int>("count");
+
+  QTest::newRow("10") << 10;
+  QTest::newRow("1k") << 1000;
+  QTest::newRow("10k") << 10000;
+}
+
+QString DeviceModelBenchmark::deviceHash(int index)
+{
+  const QByteArray seed = QByteArray::number(index);
+  return QString::fromLatin1(QCryptographicHash::hash(seed, QCryptographicHash::Sha256).toBase64());
+}
+
+LazyRule DeviceModelBenchmark::createDevice(int index, int parent_index, bool hub)
+{
+  const QString hash = deviceHash(index);
+  const QString parent_hash = deviceHash(parent_index);
+  const QString name = hub ? QString::fromLatin1("Hub %1").arg(index) : QString::fromLatin1("Device %1").arg(index);
+  const QString port = QString::fromLatin1("1-%1").arg(index);
+  const QString interface = hub ? QLatin1String("09:00:00") : QLatin1String("03:01:01");
+  const QString rule_string = QString::fromLatin1("block id 1d6b:0002 serial \"%1\" name \"%2\" hash \"%3\" parent-hash \"%4\" via-port \"%5\" with-interface %6")
+    .arg(index).arg(name, hash, parent_hash, port, interface);
+
+  QMap<QString, QString> attributes;
+  attributes.insert(QLatin1String("id"), QLatin1String("1d6b:0002"));
+  attributes.insert(QLatin1String("serial"), QString::number(index));
+  attributes.insert(QLatin1String("name"), name);
+  attributes.insert(QLatin1String("hash"), hash);
+  attributes.insert(QLatin1String("parent-hash"), parent_hash);
+  attributes.insert(QLatin1String("via-port"), port);
+  attributes.insert(QLatin1String("with-interface"), interface);
+
+  LazyRule device_rule(rule_string, Rule::Target::Block, attributes);
+  device_rule.setRuleID(index + 1);
+  return device_rule;
+}
+
+QList<LazyRule> DeviceModelBenchmark::createDevices(int count, int ports)
+{
+  /*
+   * Breadth first, so a parent is always listed before its children; the
+   * device 0 is the root hub, whose parent (-1) is not in the tree.
+   */
+  QList<LazyRule> devices;
+  devices.reserve(count);
+
+  for (int i = 0; i < count; ++i) {
+    const bool hub = i < count / ports + 1;
+    devices.append(createDevice(i, i > 0 ? (i - 1) / ports : -1, hub));
+  }
+
+  return devices;
+}
+
+void DeviceModelBenchmark::fillModel(DeviceModel& model, const QList<LazyRule>& devices)
+{
+  for (const LazyRule& device_rule : devices) {
+    model.insertDevice(device_rule);
+  }
+}
+
+int DeviceModelBenchmark::readAll(const DeviceModel& model, const QModelIndex& parent)
+{
+  int count = 0;
+  const int rows = model.rowCount(parent);
+  const int columns = model.columnCount(parent);
+
+  for (int row = 0; row < rows; ++row) {
+    for (int column = 0; column < columns; ++column) {
+      const QModelIndex index = model.index(row, column, parent);
+      count += model.data(index, Qt::DisplayRole).toString().size();
+      count += model.data(index, DeviceModel::RuleTarget).isValid() ? 1 : 0;
+    }
+
+    count += readAll(model, model.index(row, 0, parent));
+  }
+
+  return count;
+}
+
+void DeviceModelBenchmark::insertTopLevelDevice()
+{
+  /*
+   * A second root hub plugged in while the view is shown, e.g. a dock: the
+   * view has to lay out the new top level row, and drop it on removal.
+   */
+  DeviceModel model;
+  fillModel(model, createDevices(10));
+
+  QTreeView view;
+  view.setModel(&model);
+  view.show();
+  QVERIFY(QTest::qWaitForWindowExposed(&view));
+
+  const QModelIndex root_hub = model.index(0, 0);
+  QVERIFY(!view.indexBelow(root_hub).isValid());
+
+  const LazyRule dock = createDevice(100, -2, /*hub=*/true);
+  model.insertDevice(dock);
+  QCOMPARE(model.rowCount(), 2);
+  QCOMPARE(view.indexBelow(root_hub), model.index(1, 0));
+  QVERIFY(view.visualRect(model.index(1, 0)).isValid());
+
+  model.removeDevice(dock.getRuleID());
+  QCOMPARE(model.rowCount(), 1);
+  QVERIFY(!view.indexBelow(root_hub).isValid());
+}
+
+void DeviceModelBenchmark::insertDevice_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::insertDevice()
+{
+  QFETCH(int, count);
+  const QList<LazyRule> devices = createDevices(count);
+
+  QBENCHMARK {
+    DeviceModel model;
+    fillModel(model, devices);
+  }
+}
+
+void DeviceModelBenchmark::removeDevice_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::removeDevice()
+{
+  QFETCH(int, count);
+  const QList<LazyRule> devices = createDevices(count);
+  DeviceModel model;
+  fillModel(model, devices);
+
+  /* Removing the root hub takes the whole tree, so it can only run once. */
+  QBENCHMARK_ONCE {
+    model.removeDevice(devices.first().getRuleID());
+  }
+
+  QCOMPARE(model.rowCount(), 0);
+}
+
+void DeviceModelBenchmark::removeLastChild_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::removeLastChild()
+{
+  /*
+   * All the devices on a single hub: removing (and inserting back) the
+   * last one must not depend on the number of its siblings.
+   */
+  QFETCH(int, count);
+  const QList<LazyRule> devices = createDevices(count + 1, /*ports=*/count);
+  DeviceModel model;
+  fillModel(model, devices);
+  const LazyRule& last = devices.last();
+
+  QBENCHMARK {
+    model.removeDevice(last.getRuleID());
+    model.insertDevice(last);
+  }
+
+  QCOMPARE(model.rowCount(model.index(0, 0)), count);
+}
+
+void DeviceModelBenchmark::lastChildIndex_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::lastChildIndex()
+{
+  /* index() and parent() of the last of count siblings: the row is cached. */
+  QFETCH(int, count);
+  DeviceModel model;
+  fillModel(model, createDevices(count + 1, /*ports=*/count));
+  const QModelIndex hub = model.index(0, 0);
+  QCOMPARE(model.rowCount(hub), count);
+
+  QBENCHMARK {
+    const QModelIndex last = model.index(count - 1, 0, hub);
+    QCOMPARE(model.parent(last), hub);
+    QCOMPARE(model.parent(hub), QModelIndex());
+  }
+}
+
+void DeviceModelBenchmark::containsDeviceHash_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::containsDeviceHash()
+{
+  QFETCH(int, count);
+  const QList<LazyRule> devices = createDevices(count);
+  DeviceModel model;
+  fillModel(model, devices);
+  const QByteArray first_key = devices.first().getHashKey();
+  const QByteArray last_key = devices.last().getHashKey();
+  const QByteArray missing_key = createDevice(count, -1, /*hub=*/false).getHashKey();
+
+  QBENCHMARK {
+    QVERIFY(model.containsDeviceHash(first_key));
+    QVERIFY(model.containsDeviceHash(last_key));
+    QVERIFY(!model.containsDeviceHash(missing_key));
+  }
+}
+
+void DeviceModelBenchmark::updateDeviceTarget_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::updateDeviceTarget()
+{
+  QFETCH(int, count);
+  const QList<LazyRule> devices = createDevices(count);
+  DeviceModel model;
+  fillModel(model, devices);
+  bool allow = true;
+
+  QBENCHMARK {
+    const Rule::Target target = allow ? Rule::Target::Allow : Rule::Target::Block;
+
+    for (const LazyRule& device_rule : devices) {
+      model.updateDeviceTarget(device_rule.getRuleID(), target);
+    }
+
+    allow = !allow;
+  }
+}
+
+void DeviceModelBenchmark::getModifiedDevices_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::getModifiedDevices()
+{
+  QFETCH(int, count);
+  DeviceModel model;
+  fillModel(model, createDevices(count));
+
+  /* Every other child of the root hub gets a new requested target. */
+  const QModelIndex root_hub = model.index(0, 0);
+  int modified = 0;
+
+  for (int row = 0; row < model.rowCount(root_hub); row += 2) {
+    model.setData(model.index(row, 0, root_hub), QVariant::fromValue(Rule::Target::Allow), DeviceModel::RuleTarget);
+    ++modified;
+  }
+
+  QBENCHMARK {
+    QCOMPARE(model.getModifiedDevices().count(), modified);
+  }
+}
+
+void DeviceModelBenchmark::data_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::data()
+{
+  QFETCH(int, count);
+  DeviceModel model;
+  fillModel(model, createDevices(count));
+
+  QBENCHMARK {
+    QVERIFY(readAll(model, QModelIndex()) > 0);
+  }
+}
+
+void DeviceModelBenchmark::paint_data()
+{
+  addSizes();
+}
+
+void DeviceModelBenchmark::paint()
+{
+  QFETCH(int, count);
+  DeviceModel model;
+  fillModel(model, createDevices(count));
+
+  QTreeView view;
+  view.setModel(&model);
+  view.resize(800, 600);
+  view.expandAll();
+  view.show();
+  QVERIFY(QTest::qWaitForWindowExposed(&view));
+
+  QPixmap pixmap(view.viewport()->size());
+
+  QBENCHMARK {
+    view.viewport()->render(&pixmap);
+  }
+}
+
+QTEST_MAIN(DeviceModelBenchmark)
+
+#include "DeviceModelBenchmark.moc"
+
+/* vim: set ts=2 sw=2 et */